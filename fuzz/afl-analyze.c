@@ -35,6 +35,7 @@
 #include "debug.h"
 #include "alloc-inl.h"
 #include "hash.h"
+#include "layout-inl.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -69,7 +70,8 @@ static u32 in_len,                    /* Input data length                 */
            orig_cksum,                /* Original checksum                 */
            total_execs,               /* Total number of execs             */
            exec_hangs,                /* Total number of hangs             */
-           exec_tmout = EXEC_TIMEOUT; /* Exec timeout (ms)                 */
+           exec_tmout = EXEC_TIMEOUT, /* Exec timeout (ms)                 */
+           map_size = MAP_SIZE;       /* Map size of the target binary     */
 
 static u64 mem_limit = MEM_LIMIT;     /* Memory limit (MB)                 */
 
@@ -166,7 +168,8 @@ static void setup_shm(void) {
 
   u8* shm_str;
 
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+  shm_id = shmget(IPC_PRIVATE, MAP_SIZE + PDGF_MAX_TARGETS,
+                  IPC_CREAT | IPC_EXCL | 0600);
 
   if (shm_id < 0) PFATAL("shmget() failed");
 
@@ -330,6 +333,11 @@ static u32 run_target(char** argv, u8* mem, u32 len, u8 first_run) {
   if (*(u32*)trace_bits == EXEC_FAIL_SIG)
     FATAL("Unable to execute '%s'", argv[0]);
 
+  /* With a compact map, the target bytes come right after it. They aren't
+     coverage, so leave them out. */
+
+  memset(trace_bits + map_size, 0, MAP_SIZE - map_size);
+
   classify_counts(trace_bits);
   total_execs++;
 
@@ -1064,6 +1072,8 @@ int main(int argc, char** argv) {
   set_up_environment();
 
   find_binary(argv[optind]);
+
+  map_size = read_map_layout(target_path);
   detect_file_args(argv + optind);
 
   if (qemu_mode)
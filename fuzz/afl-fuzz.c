@@ -42,6 +42,7 @@
 #include "debug.h"
 #include "alloc-inl.h"
 #include "hash.h"
+#include "layout-inl.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -60,6 +61,7 @@
 
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <sys/shm.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -68,6 +70,7 @@
 #include <sys/ioctl.h>
 #include <sys/file.h>
 #include <sys/ptrace.h>
+#include <sys/timerfd.h>
 #include <sys/user.h>
 #include <sys/wait.h>
 #include <math.h>
@@ -83,6 +86,14 @@
 #define HAVE_AFFINITY 1
 #endif /* __linux__ */
 
+/* SIMD map kernels need x86-64 and a compiler that takes per-function target
+   attributes, so that the rest of the binary still runs anywhere. */
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_MAP_SIMD 1
+#include <immintrin.h>
+#endif /* __x86_64__ && __GNUC__ */
+
 /* A toggle to export some variables when building as a library. Not very
    useful for the general public. */
 
@@ -120,6 +131,8 @@ EXP_ST u8 *in_dir, /* Input directory with test cases  */
     *orig_cmdline; /* Original command line            */
 
 EXP_ST u32 exec_tmout = EXEC_TIMEOUT; /* Configurable exec timeout (ms)   */
+static u64 exec_tmout_us = EXEC_TIMEOUT * 1000ULL; /* The same, in us  */
+static u64 cur_tmout_us = EXEC_TIMEOUT * 1000ULL;  /* For queue_cur (us) */
 static u32 hang_tmout = EXEC_TIMEOUT; /* Timeout used for hang det (ms)   */
 
 EXP_ST u64 mem_limit = MEM_LIMIT; /* Memory cap for child (MB)        */
@@ -147,6 +160,8 @@ EXP_ST u8 skip_deterministic, /* Skip deterministic stages?       */
     no_cpu_meter_red,         /* Feng shui on the status screen   */
     no_arith,                 /* Skip most arithmetic ops         */
     shuffle_queue,            /* Shuffle input queue?             */
+    heap_sched,               /* Pick entries off a priority heap? */
+    adaptive_tmout,           /* Timeouts from queue exec times?  */
     bitmap_changed = 1,       /* Time to update bitmap?           */
     qemu_mode,                /* Running in QEMU mode?            */
     skip_requested,           /* Skip request, via SIGUSR1        */
@@ -154,7 +169,8 @@ EXP_ST u8 skip_deterministic, /* Skip deterministic stages?       */
     persistent_mode,          /* Running in persistent mode?      */
     deferred_mode,            /* Deferred forkserver mode?        */
     direct,
-    fast_cal; /* Try to calibrate faster?         */
+    fast_cal,                 /* Try to calibrate faster?         */
+    memfd_input;              /* @@ file is a memfd?              */
 
 static s32 out_fd,       /* Persistent fd for out_file       */
     dev_urandom_fd = -1, /* Persistent fd for /dev/urandom   */
@@ -164,10 +180,23 @@ static s32 out_fd,       /* Persistent fd for out_file       */
 
 static s32 forksrv_pid, /* PID of the fork server           */
     child_pid = -1,     /* PID of the fuzzed program        */
-    out_dir_fd = -1;    /* FD of the lock file              */
+    out_dir_fd = -1,    /* FD of the lock file              */
+    nav_fsrv_pid,       /* PID of the checker fork server   */
+    nav_ctl_fd = -1,    /* Checker fork server control pipe */
+    nav_st_fd = -1,     /* Checker fork server status pipe  */
+    region_log_fd = -1, /* Append-only region extension log */
+    persist_pid;        /* Stopped persistent-mode child    */
+
+static u8 nav_no_forksrv, /* Checker forkserver unavailable?  */
+    nav_live;             /* Patch running processes in place? */
 
 EXP_ST u8 *trace_bits; /* SHM with instrumentation bitmap  */
 
+static u32 map_size = MAP_SIZE; /* Map size the target was built for */
+
+static u32 slice_cvg[3]; /* virgin_bits bytes covered in the
+                            region, middle and outer slices   */
+
 EXP_ST u8 virgin_bits[MAP_SIZE], /* Regions yet untouched by fuzzing */
     virgin_tmout[MAP_SIZE],      /* Bits we haven't seen in tmouts   */
     virgin_crash[MAP_SIZE];      /* Bits we haven't seen in crashes  */
@@ -176,6 +205,55 @@ static u8 var_bytes[MAP_SIZE]; /* Bytes that appear to be variable */
 
 static s32 shm_id; /* ID of the SHM region             */
 
+static s32 shm_fuzz_id = -1; /* ID of the testcase SHM region    */
+
+static u8 *shm_fuzz,   /* Testcase length, then its data   */
+    use_shm_fuzz;      /* Director reads testcases from it */
+
+static u32 prev_timed_out; /* Last run killed by us?           */
+
+static u64 child_start_us, /* When the current run started     */
+    last_exec_us;          /* How long the last run took       */
+
+/* With -j, the director runs as several executors, each with its own
+   forkserver, trace map and input. Only the selected one lives in the
+   globals above; select_executor() swaps them. */
+
+struct executor
+{
+
+  u8 *trace_bits, *shm_fuzz, *out_file, use_shm_fuzz, child_timed_out;
+  s32 shm_id, shm_fuzz_id, forksrv_pid, child_pid, persist_pid, out_fd,
+      fsrv_ctl_fd, fsrv_st_fd, cpu;
+  u32 prev_timed_out;
+  u64 child_start_us;
+
+  char **argv;  /* Director argv with our own @@ file */
+  u8 *tc_mem;   /* Last test case written for us      */
+  u32 tc_len;
+};
+
+static struct executor *execs; /* Executors, if more than one      */
+
+static u32 exec_cnt = 1, /* Number of executors (-j)         */
+    cur_exec;            /* Selected executor                */
+
+/* Havoc runs in flight, one slot per executor: */
+
+enum
+{
+  /* 00 */ BATCH_IDLE,    /* Nothing to collect               */
+  /* 01 */ BATCH_RUNNING, /* Launched, not reaped yet         */
+  /* 02 */ BATCH_STALE    /* Reaped early, to be run again    */
+};
+
+static u8 *batch_buf[MAX_EXECUTORS], /* Mutant being run              */
+    batch_state[MAX_EXECUTORS];      /* BATCH_*                       */
+
+static u32 batch_len[MAX_EXECUTORS], /* Mutant lengths                */
+    batch_cap[MAX_EXECUTORS],        /* Buffer sizes                  */
+    batch_next;                      /* Slot to retire and reuse next */
+
 static volatile u8 stop_soon, /* Ctrl-C pressed?                  */
     clear_screen = 1,         /* Window resized?                  */
     child_timed_out;          /* Traced process timed out?        */
@@ -199,6 +277,9 @@ EXP_ST u32 queued_paths, /* Total number of queued testcases */
     bitmap_size_d_max = 0,
     bitmap_size_d_min = 0,
     total_edges = 0,
+    nav_stop_budget = NAV_STOP_BUDGET,   /* Max traps per navigator run      */
+    nav_patch_budget = NAV_PATCH_BUDGET, /* Max sites patched per run        */
+    nav_tmout,                           /* Navigator timeout (ms), 0 = auto */
     maturity,
     havoc_div = 1; /* Cycle count divisor for havoc    */
 
@@ -220,7 +301,30 @@ EXP_ST u64 total_crashes, /* Total number of crashes          */
     bytes_trim_in,        /* Bytes coming into the trimmer    */
     bytes_trim_out,       /* Bytes coming outa the trimmer    */
     blocks_eff_total,     /* Blocks subject to effector maps  */
-    blocks_eff_select;    /* Blocks selected as fuzzable      */
+    blocks_eff_select,    /* Blocks selected as fuzzable      */
+    nav_sessions,         /* Navigator runs so far            */
+    nav_truncated,        /* Runs cut short by a limit        */
+    nav_timeouts,         /* Runs killed by the timeout       */
+    nav_sites_patched,    /* Sites moved into the region      */
+    nav_sites_synced,     /* ...of which came from peers      */
+    nav_sites_retired;    /* Extensions taken back out        */
+
+/* Target lines marked by the pass, with their slots in target_bits. */
+
+struct target_stat
+{
+  u8 *name;      /* "file:line", NULL if unused      */
+  u8 reached;    /* Hit at least once?               */
+  u64 first_ms,  /* Time of the first hit, from start */
+      hits;      /* Execs that reached it            */
+};
+
+static struct target_stat target_stats[PDGF_MAX_TARGETS];
+
+static u8 *target_bits; /* Target slots, right after the map */
+
+static u32 targets_total,   /* Targets present in the binaries  */
+    targets_reached;        /* ...of which were hit             */
 
 static u32 subseq_tmouts; /* Number of timeouts in a row      */
 
@@ -265,36 +369,49 @@ struct queue_entry
 {
 
   u8 *fname; /* File name for the test case      */
-  u32 len;   /* Input length                     */
+  u32 id;    /* Index in queue_buf               */
 
   u8 cal_failed,    /* Calibration failed?              */
       trim_done,    /* Trimmed?                         */
-      was_fuzzed,   /* Had any fuzzing done yet?        */
       passed_det,   /* Deterministic stages passed?     */
       has_new_cov,  /* Triggers new coverage?           */
       var_behavior, /* Variable behavior?               */
-      favored,      /* Currently favored?               */
       fs_redundant; /* Marked as redundant in the fs?   */
 
   u32 bitmap_size, /* Number of bits set in bitmap     */
-      bitmap_size_d,
-      exec_cksum; /* Checksum of the execution trace  */
+      exec_cksum;  /* Checksum of the execution trace  */
 
-  u64 exec_us,  /* Execution time (us)              */
-      handicap, /* Number of queue cycles behind    */
+  u64 handicap, /* Number of queue cycles behind    */
       depth;    /* Path depth                       */
 
-  u8 *trace_mini; /* Trace bytes, if kept             */
-  u32 tc_ref;     /* Trace bytes ref count            */
-
-  struct queue_entry *next, /* Next element, if any             */
-      *next_100;            /* 100 elements ahead               */
+  u16 *trace_mini; /* Sorted indices of trace bytes    */
+  u32 mini_cnt,    /* Number of indices in trace_mini  */
+      tc_ref;      /* Trace bytes ref count            */
 };
 
-static struct queue_entry *queue, /* Fuzzing queue (linked list)      */
-    *queue_cur,                   /* Current offset within the queue  */
-    *queue_top,                   /* Top of the list                  */
-    *q_prev100;                   /* Previous 100 marker              */
+static struct queue_entry **queue_buf, /* Fuzzing queue, by entry ID       */
+    *queue_cur,                        /* Current offset within the queue  */
+    *queue_top;                        /* Last entry added                 */
+
+static u32 queue_buf_size; /* Entries allocated in queue_buf   */
+
+/* The fields the scheduler looks at for every entry live in arrays of their
+   own, indexed by queue_entry.id and grown together with queue_buf. */
+
+static u8 *q_favored,    /* Currently favored?               */
+    *q_was_fuzzed;       /* Had any fuzzing done yet?        */
+static u32 *q_len,       /* Input length                     */
+    *q_bitmap_size_d;    /* Region-weighted bitmap size      */
+static u64 *q_exec_us;   /* Execution time (us)              */
+
+/* With AFL_HEAP_SCHED, entries are kept in a binary max-heap on sched_prio;
+   sched_pos maps an entry ID back to its heap slot. */
+
+static u32 *q_fuzz_cnt,  /* Times picked by the scheduler    */
+    *sched_heap,         /* Entry IDs, highest priority first */
+    *sched_pos;          /* Heap slot of every entry         */
+static double *sched_prio; /* Current priority of every entry  */
+static u32 sched_d_min = 0xffffffff; /* Least bitmap_size_d calibrated */
 
 static struct queue_entry *
     top_rated[MAP_SIZE]; /* Top entries for bitmap bytes     */
@@ -314,6 +431,105 @@ static u32 a_extras_cnt;            /* Total number of tokens available */
 
 static u8 *(*post_handler)(u8 *buf, u32 *len);
 
+/* One entry of the marker table emitted by the LLVM pass into the
+   __pdgf_sites section, resolved to a file offset. */
+
+struct nav_site
+{
+  u32 off,      /* File offset of the marker        */
+      cur_loc,  /* Block ID the pass assigned       */
+      prev_loc; /* What the block puts in prev_loc  */
+  u8 flags;    /* PDGF_SITE_* and NAV_SITE_* flags */
+};
+
+/* Set on table entries once the navigator moved them into the region, and
+   once region maintenance took them out again for good. */
+
+#define NAV_SITE_EXTENDED 0x80
+#define NAV_SITE_RETIRED 0x40
+
+/* Instrumented objects the navigator can patch: the target binary itself,
+   plus any shared libraries listed in AFL_PDGF_LIBS. Each one has its own
+   checker and director copy in the output directory. */
+
+struct nav_object
+{
+  u8 *name,           /* Object name (basename)           */
+      *checker_path,  /* Checker copy                     */
+      *director_path, /* Director copy                    */
+      *maps_path,     /* Checker copy, as seen in maps    */
+      *dir_maps_path; /* Director copy, as seen in maps   */
+
+  u8 *w;      /* Director image while navigating  */
+  u32 w_size; /* Director image size              */
+
+  struct nav_site *sites; /* Marker table, sorted by offset   */
+  u32 site_cnt;           /* Number of markers in the table   */
+};
+
+static struct nav_object *nav_objs; /* Patchable objects, target first  */
+static u32 nav_obj_cnt;             /* Number of patchable objects      */
+
+static u8 *nav_checker_libs; /* LD_LIBRARY_PATH for the checker  */
+
+/* Executable mappings of the patchable objects in the checker, as read from
+   /proc/<pid>/maps. */
+
+struct nav_range
+{
+  u64 start, end, /* Mapped address range             */
+      off;        /* File offset of start             */
+  u32 obj;        /* Index into nav_objs              */
+};
+
+static struct nav_range *nav_ranges; /* Cached checker mappings          */
+static u32 nav_range_cnt;            /* Number of cached mappings        */
+
+/* A region extension, with what it takes to undo it and how it has done
+   since. The director marker is always eb 00 90 originally; the block ID
+   immediates are saved as found. */
+
+struct nav_ext
+{
+  u32 obj, /* Index into nav_objs              */
+      off, /* File offset of the marker        */
+      loc; /* Block ID in the region slice     */
+
+  u32 id_off[2];    /* File offsets of the ID immediates */
+  u8 id_len[2];     /* ...their sizes (0 = not found)    */
+  u8 id_orig[2][4]; /* ...and their original bytes       */
+
+  u64 born,         /* total_execs when extended        */
+      finds,        /* Finds whose path went through it */
+      region_finds; /* ...that added region coverage    */
+
+  u8 dead, /* Retired?                         */
+      hit; /* Scratch flag for credit_nav_exts */
+};
+
+static struct nav_ext *nav_exts; /* Region extensions, oldest first  */
+static u32 nav_ext_cnt,          /* Number of extensions             */
+    nav_ext_grace = NAV_EXT_GRACE; /* Execs before retiring is allowed */
+
+/* A write made to one of the binaries while nav_live is set, to be repeated
+   in the memory of the processes running off it. */
+
+struct nav_poke
+{
+  u32 obj, /* Index into nav_objs              */
+      off; /* File offset                      */
+  u8 dir,  /* Director (1) or checker (0)?     */
+      len, /* Number of bytes                  */
+      data[4];
+};
+
+static struct nav_poke *nav_pokes; /* Writes not yet poked             */
+static u32 nav_poke_cnt;           /* Number of such writes            */
+
+static u8 nav_region_loc[MAP_SIZE >> 2], /* Block IDs in the region slice    */
+    nav_region_prev[MAP_SIZE >> 2],       /* Their prev_loc values            */
+    nav_locs_stale = 1;                   /* nav_region_loc needs a rebuild?  */
+
 /* Interesting values, as per config.h */
 
 static s8 interesting_8[] = {INTERESTING_8};
@@ -429,6 +645,103 @@ static void setup_args(int argc, char **argv)
   return;
 }
 
+/* Register a patchable object. The path seen in /proc/<pid>/maps is the
+   canonical one, so resolve it once here. */
+
+static void add_nav_object(u8 *name, u8 *checker, u8 *director)
+{
+
+  struct nav_object *o;
+
+  nav_objs = ck_realloc(nav_objs, (nav_obj_cnt + 1) * sizeof(struct nav_object));
+  o = &nav_objs[nav_obj_cnt++];
+
+  o->name = name;
+  o->checker_path = checker;
+  o->director_path = director;
+
+  o->maps_path = (u8 *)realpath((char *)checker, NULL);
+  if (!o->maps_path)
+    PFATAL("Unable to resolve '%s'", checker);
+
+  o->dir_maps_path = (u8 *)realpath((char *)director, NULL);
+  if (!o->dir_maps_path)
+    PFATAL("Unable to resolve '%s'", director);
+
+  o->w = NULL;
+  o->w_size = 0;
+
+  o->sites = NULL;
+  o->site_cnt = 0;
+}
+
+/* Copy the instrumented shared libraries listed in AFL_PDGF_LIBS (separated
+   by colons) into <out_dir>/pdgf_libs/{checker,director}/ and point the
+   dynamic linker at the right set: the director library path goes into our
+   own environment, the checker one is set up in the navigator's children. */
+
+static void setup_nav_libs(void)
+{
+
+  u8 *libs = (u8 *)getenv("AFL_PDGF_LIBS");
+  u8 *ck_dir, *dr_dir, *tmp, *cur, *old;
+
+  if (!libs || !*libs)
+    return;
+
+  tmp = alloc_printf("%s/pdgf_libs", out_dir);
+  if (mkdir(tmp, 0700) && errno != EEXIST)
+    PFATAL("Unable to create '%s'", tmp);
+  ck_free(tmp);
+
+  ck_dir = alloc_printf("%s/pdgf_libs/checker", out_dir);
+  if (mkdir(ck_dir, 0700) && errno != EEXIST)
+    PFATAL("Unable to create '%s'", ck_dir);
+
+  dr_dir = alloc_printf("%s/pdgf_libs/director", out_dir);
+  if (mkdir(dr_dir, 0700) && errno != EEXIST)
+    PFATAL("Unable to create '%s'", dr_dir);
+
+  libs = ck_strdup(libs);
+
+  for (cur = (u8 *)strtok((char *)libs, ":"); cur;
+       cur = (u8 *)strtok(NULL, ":"))
+  {
+
+    u8 *name = ck_strdup((u8 *)basename((char *)cur));
+    u8 *ck = alloc_printf("%s/%s", ck_dir, name);
+    u8 *dr = alloc_printf("%s/%s", dr_dir, name);
+
+    unlink(ck);
+    unlink(dr);
+
+    if (read_map_layout(cur) != map_size)
+      FATAL("Library '%s' was built for a different map size than the target",
+            name);
+
+    copy_binary((char *)cur, (char *)ck);
+    copy_binary((char *)cur, (char *)dr);
+
+    add_nav_object(name, ck, dr);
+
+    OKF("Instrumented library '%s' will be patched, too.", name);
+  }
+
+  ck_free(libs);
+
+  old = (u8 *)getenv("LD_LIBRARY_PATH");
+
+  nav_checker_libs = alloc_printf("%s%s%s", ck_dir, old ? ":" : "",
+                                  old ? old : (u8 *)"");
+
+  tmp = alloc_printf("%s%s%s", dr_dir, old ? ":" : "", old ? old : (u8 *)"");
+  setenv("LD_LIBRARY_PATH", (char *)tmp, 1);
+  ck_free(tmp);
+
+  ck_free(ck_dir);
+  ck_free(dr_dir);
+}
+
 void setup_two_binary()
 {
   u8 *director_fname = alloc_printf("%s", director_path);
@@ -442,13 +755,165 @@ void setup_two_binary()
   copy_binary(target_path, checker_path);
   copy_binary(target_path, director_path);
 
+  add_nav_object((u8 *)basename((char *)target_path), checker_path,
+                 director_path);
+
+  setup_nav_libs();
+
   return;
 }
 
-void modify_two_binary()
+static int compare_nav_sites(const void *a, const void *b)
 {
-  OKF("Modify the two binary files\n");
-  FILE *checker_file = fopen(checker_path, "rb+");
+
+  u32 x = ((struct nav_site *)a)->off, y = ((struct nav_site *)b)->off;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Load the marker table of an object, if the pass emitted one. Each record
+   holds the marker address relative to the record itself, the block's
+   cur_loc and its flags; we turn the addresses into file offsets via the
+   executable section that contains them. */
+
+static void load_site_table(struct nav_object *o)
+{
+
+  Elf64_Ehdr *ehdr;
+  Elf64_Shdr *shdr, *tab = NULL;
+  u8 *fdata, *names;
+  u32 i, j, n, bad = 0;
+  s32 fd;
+  off_t fsize;
+
+  fd = open((char *)o->checker_path, O_RDONLY);
+  if (fd < 0)
+    PFATAL("Unable to open '%s'", o->checker_path);
+
+  fsize = lseek(fd, 0, SEEK_END);
+  fdata = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (fdata == MAP_FAILED)
+    PFATAL("mmap() failed on '%s'", o->checker_path);
+
+  close(fd);
+
+  ehdr = (Elf64_Ehdr *)fdata;
+  shdr = (Elf64_Shdr *)(fdata + ehdr->e_shoff);
+  names = fdata + shdr[ehdr->e_shstrndx].sh_offset;
+
+  for (i = 0; i < ehdr->e_shnum; i++)
+    if (!strcmp((char *)names + shdr[i].sh_name, PDGF_SITES_SECTION))
+      tab = &shdr[i];
+
+  if (!tab || tab->sh_type == SHT_NOBITS)
+  {
+    munmap(fdata, fsize);
+    return;
+  }
+
+  n = tab->sh_size / PDGF_SITE_SIZE;
+  o->sites = ck_alloc(n * sizeof(struct nav_site));
+
+  for (i = 0; i < n; i++)
+  {
+
+    u8 *rec = fdata + tab->sh_offset + i * PDGF_SITE_SIZE;
+    u64 addr = tab->sh_addr + i * PDGF_SITE_SIZE + *(s32 *)rec;
+
+    for (j = 0; j < ehdr->e_shnum; j++)
+    {
+
+      if (!(shdr[j].sh_flags & SHF_EXECINSTR) || shdr[j].sh_type == SHT_NOBITS ||
+          addr < shdr[j].sh_addr || addr >= shdr[j].sh_addr + shdr[j].sh_size)
+        continue;
+
+      o->sites[o->site_cnt].off = addr - shdr[j].sh_addr + shdr[j].sh_offset;
+      o->sites[o->site_cnt].cur_loc = *(u32 *)(rec + 4);
+      o->sites[o->site_cnt].flags = *(u32 *)(rec + 8);
+      o->sites[o->site_cnt].prev_loc = (rec[8] & PDGF_SITE_EXACT)
+                                           ? *(u32 *)(rec + 8) >> 16
+                                           : *(u32 *)(rec + 4) >> 1;
+      break;
+    }
+
+    /* Entries that don't point at a marker are dropped (and reported). */
+
+    if (j == ehdr->e_shnum ||
+        memcmp(fdata + o->sites[o->site_cnt].off, "\xeb\x00\x90", 3))
+      bad++;
+    else
+      o->site_cnt++;
+  }
+
+  munmap(fdata, fsize);
+
+  qsort(o->sites, o->site_cnt, sizeof(struct nav_site), compare_nav_sites);
+
+  if (bad)
+    WARNF("%u bogus entries in the marker table of '%s'.", bad, o->name);
+
+  OKF("Loaded %u markers from the table in '%s'.", o->site_cnt, o->name);
+}
+
+/* Find the table entry for the marker at a given file offset. */
+
+static struct nav_site *find_nav_site(struct nav_object *o, u32 off)
+{
+
+  u32 lo = 0, hi = o->site_cnt;
+
+  while (lo < hi)
+  {
+
+    u32 mid = (lo + hi) / 2;
+
+    if (o->sites[mid].off == off)
+      return &o->sites[mid];
+
+    if (o->sites[mid].off < off)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return NULL;
+}
+
+/* Turn the markers listed in the table into int3 in the checker copy. */
+
+static void patch_checker_sites(struct nav_object *o)
+{
+
+  static u8 jmp_des[2] = {0xCC, 0x90};
+
+  FILE *checker_file = fopen((char *)o->checker_path, "rb+");
+  u32 i;
+
+  if (!checker_file)
+    PFATAL("Unable to open '%s'", o->checker_path);
+
+  for (i = 0; i < o->site_cnt; i++)
+  {
+
+    if (fseek(checker_file, o->sites[i].off, SEEK_SET))
+      PFATAL("Unable to seek in '%s'", o->checker_path);
+
+    if (fwrite(jmp_des, sizeof(jmp_des), 1, checker_file) != 1)
+      PFATAL("Unable to write '%s'", o->checker_path);
+  }
+
+  fclose(checker_file);
+}
+
+/* Without a marker table, turn every marker in the .text of a checker copy
+   into int3 by scanning for the byte pattern. Section file offsets are all
+   we need here, so this works the same for PIE executables and shared
+   objects. */
+
+static void patch_checker_markers(u8 *path)
+{
+  FILE *checker_file = fopen(path, "rb+");
   // FILE * director_file=fopen(director_path,"rb+");
 
   Elf64_Ehdr *ehdr_64;
@@ -459,8 +924,8 @@ void modify_two_binary()
   long file_size;
   int fd;
 
-  if ((fd = (open(checker_path, O_RDONLY))) == -1)
-    PFATAL("openfile %s error", checker_path);
+  if ((fd = (open(path, O_RDONLY))) == -1)
+    PFATAL("openfile %s error", path);
 
   if ((file_size = lseek((fd), 0, SEEK_END)) == -1)
   {
@@ -512,9 +977,28 @@ void modify_two_binary()
     }
   }
 
+  munmap(fdata, file_size);
+  close(fd);
+
   fclose(checker_file);
 }
 
+void modify_two_binary()
+{
+  OKF("Modify the two binary files\n");
+
+  for (u32 i = 0; i < nav_obj_cnt; i++)
+  {
+
+    load_site_table(&nav_objs[i]);
+
+    if (nav_objs[i].site_cnt)
+      patch_checker_sites(&nav_objs[i]);
+    else
+      patch_checker_markers(nav_objs[i].checker_path);
+  }
+}
+
 /* Get unix time in milliseconds */
 
 static u64 get_cur_time(void)
@@ -541,6 +1025,80 @@ static u64 get_cur_time_us(void)
   return (tv.tv_sec * 1000000ULL) + tv.tv_usec;
 }
 
+/* Hot-path profiling. Each counter adds up the time spent in one function,
+   including whatever it calls, along with the number of calls. We read the
+   TSC where there is one and turn ticks into time by comparing against the
+   wall clock since startup. */
+
+enum
+{
+  /* 00 */ PROF_RUN_TARGET,
+  /* 01 */ PROF_HAS_NEW_BITS,
+  /* 02 */ PROF_NAV_TRACE,
+  /* 03 */ PROF_NAV_PATCH,
+  /* 04 */ PROF_CALIBRATE,
+  /* 05 */ PROF_TRIM,
+  /* 06 */ PROF_CULL,
+  /* 07 */ PROF_SCORE,
+  /* 08 */ PROF_SYNC,
+  /* 09 */ PROF_WRITE_TC,
+  PROF_COUNT
+};
+
+static const char *prof_names[PROF_COUNT] = {
+    "run_target", "has_new_bits", "nav_trace", "nav_patch", "calibrate",
+    "trim", "cull_queue", "score", "sync", "write_testcase"};
+
+static u64 prof_ticks[PROF_COUNT], /* Ticks spent per counter          */
+    prof_calls[PROF_COUNT],        /* Calls per counter                */
+    prof_base_ticks,               /* Tick count at startup            */
+    prof_base_us;                  /* Wall clock at startup            */
+
+static FILE *prof_file; /* Per-second timeline, if requested */
+
+static inline u64 prof_clock(void)
+{
+
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return get_cur_time_us();
+#endif /* ^__x86_64__ || __i386__ */
+}
+
+struct prof_scope
+{
+  u32 id;    /* PROF_* counter                   */
+  u64 start; /* Tick count on entry              */
+};
+
+static inline void prof_leave(struct prof_scope *ps)
+{
+
+  prof_ticks[ps->id] += prof_clock() - ps->start;
+  prof_calls[ps->id]++;
+}
+
+/* Charge the rest of the enclosing block, however it's left, to a counter. */
+
+#define PROF_SCOPE(_id)                                          \
+  struct prof_scope __attribute__((cleanup(prof_leave))) _prof = \
+      {(_id), prof_clock()}
+
+/* Time charged to a counter so far, in milliseconds. */
+
+static double prof_ms(u32 id)
+{
+
+  u64 ticks = prof_clock() - prof_base_ticks,
+      us = get_cur_time_us() - prof_base_us;
+
+  if (!ticks)
+    return 0;
+
+  return (double)prof_ticks[id] * us / ticks / 1000;
+}
+
 /* Generate a random number (from 0 to limit - 1). This may
    have slight bias. */
 
@@ -700,6 +1258,40 @@ static void bind_to_free_cpu(void)
     FATAL("No more free CPU cores");
   }
 
+  /* Executors take a free core each, the first one sharing ours. If there
+     aren't enough, binding them all to one core would defeat the purpose,
+     so we leave everything unbound. */
+
+  if (execs)
+  {
+
+    u32 k, n = i;
+
+    for (k = 0; k < exec_cnt && n < cpu_core_count; k++)
+    {
+
+      execs[k].cpu = n++;
+
+      while (n < cpu_core_count && cpu_used[n])
+        n++;
+    }
+
+    if (k < exec_cnt)
+    {
+
+      WARNF("Not enough free CPU cores for %u executors, not binding.",
+            exec_cnt);
+
+      for (k = 0; k < exec_cnt; k++)
+        execs[k].cpu = -1;
+
+      return;
+    }
+
+    OKF("Found %u free CPU cores, binding executors to #%u-#%u.", exec_cnt,
+        i, execs[exec_cnt - 1].cpu);
+  }
+
   OKF("Found a free CPU core, binding to #%u.", i);
 
   cpu_aff = i;
@@ -984,43 +1576,169 @@ static void mark_as_redundant(struct queue_entry *q, u8 state)
   ck_free(fn);
 }
 
-/* Append new test case to the queue. */
+/* Priority of an entry for the heap scheduler. Region coverage counts most,
+   followed by being favored, not having been fuzzed yet and being recent,
+   that is, having few entries queued after it; fast entries get a boost,
+   and every pick divides the priority down so that the rest of the queue
+   gets its turn. */
 
-static void add_to_queue(u8 *fname, u32 len, u8 passed_det)
+static double sched_priority(u32 id)
 {
 
-  struct queue_entry *q = ck_alloc(sizeof(struct queue_entry));
+  double prio = 1.0, speed = 1.0;
 
-  q->fname = fname;
-  q->len = len;
-  q->depth = cur_depth + 1;
-  q->passed_det = passed_det;
+  if (bitmap_size_d_max > sched_d_min && q_bitmap_size_d[id] > sched_d_min)
+    prio += 2.0 * (q_bitmap_size_d[id] - sched_d_min) /
+            (bitmap_size_d_max - sched_d_min);
 
-  if (q->depth > max_depth)
-    max_depth = q->depth;
+  prio += (double)HEAP_RECENT_PATHS /
+          (HEAP_RECENT_PATHS + queued_paths - 1 - id);
+
+  if (q_favored[id])
+    prio += 1.0;
 
-  if (queue_top)
+  if (!q_was_fuzzed[id])
+    prio += 1.0;
+
+  if (total_cal_cycles && q_exec_us[id])
   {
 
-    queue_top->next = q;
-    queue_top = q;
+    speed = (double)total_cal_us / total_cal_cycles / q_exec_us[id];
+
+    if (speed < 0.25)
+      speed = 0.25;
+    if (speed > 4.0)
+      speed = 4.0;
   }
-  else
-    q_prev100 = queue = queue_top = q;
 
-  queued_paths++;
-  pending_not_fuzzed++;
+  return prio * speed / (1 + q_fuzz_cnt[id]);
+}
 
-  cycles_wo_finds = 0;
+static void sched_swap(u32 a, u32 b)
+{
+
+  u32 t = sched_heap[a];
+
+  sched_heap[a] = sched_heap[b];
+  sched_heap[b] = t;
+
+  sched_pos[sched_heap[a]] = a;
+  sched_pos[sched_heap[b]] = b;
+}
+
+static void sched_sift(u32 k)
+{
+
+  while (k && sched_prio[sched_heap[k]] > sched_prio[sched_heap[(k - 1) / 2]])
+  {
+    sched_swap(k, (k - 1) / 2);
+    k = (k - 1) / 2;
+  }
+
+  while (1)
+  {
+
+    u32 l = 2 * k + 1, r = l + 1, m = k;
+
+    if (l < queued_paths && sched_prio[sched_heap[l]] > sched_prio[sched_heap[m]])
+      m = l;
+    if (r < queued_paths && sched_prio[sched_heap[r]] > sched_prio[sched_heap[m]])
+      m = r;
+
+    if (m == k)
+      break;
+
+    sched_swap(k, m);
+    k = m;
+  }
+}
+
+/* Add the newest entry (already counted in queued_paths) to the heap. */
+
+static void sched_insert(u32 id)
+{
+
+  sched_heap[queued_paths - 1] = id;
+  sched_pos[id] = queued_paths - 1;
+  sched_prio[id] = sched_priority(id);
+
+  sched_sift(queued_paths - 1);
+}
+
+/* Recompute the priority of one entry after its fields changed. */
 
-  /* Set next_100 pointer for every 100th element (index 0, 100, etc) to allow faster iteration. */
-  if ((queued_paths - 1) % 100 == 0 && queued_paths > 1)
+static void sched_update(u32 id)
+{
+
+  if (!heap_sched)
+    return;
+
+  sched_prio[id] = sched_priority(id);
+  sched_sift(sched_pos[id]);
+}
+
+/* Recompute everything and rebuild the heap. Used after culling, which
+   flips favored flags all over the queue at once. */
+
+static void sched_rebuild(void)
+{
+
+  u32 i;
+
+  for (i = 0; i < queued_paths; i++)
+    sched_prio[sched_heap[i]] = sched_priority(sched_heap[i]);
+
+  for (i = queued_paths / 2; i--;)
+    sched_sift(i);
+}
+
+/* Append new test case to the queue. */
+
+static void add_to_queue(u8 *fname, u32 len, u8 passed_det)
+{
+
+  struct queue_entry *q = ck_alloc(sizeof(struct queue_entry));
+
+  if (queued_paths == queue_buf_size)
   {
 
-    q_prev100->next_100 = q;
-    q_prev100 = q;
+    queue_buf_size = queue_buf_size ? queue_buf_size * 2 : 64;
+
+    queue_buf = ck_realloc(queue_buf, queue_buf_size * sizeof(*queue_buf));
+    q_favored = ck_realloc(q_favored, queue_buf_size);
+    q_was_fuzzed = ck_realloc(q_was_fuzzed, queue_buf_size);
+    q_len = ck_realloc(q_len, queue_buf_size * sizeof(u32));
+    q_bitmap_size_d = ck_realloc(q_bitmap_size_d, queue_buf_size * sizeof(u32));
+    q_exec_us = ck_realloc(q_exec_us, queue_buf_size * sizeof(u64));
+
+    if (heap_sched)
+    {
+      q_fuzz_cnt = ck_realloc(q_fuzz_cnt, queue_buf_size * sizeof(u32));
+      sched_heap = ck_realloc(sched_heap, queue_buf_size * sizeof(u32));
+      sched_pos = ck_realloc(sched_pos, queue_buf_size * sizeof(u32));
+      sched_prio = ck_realloc(sched_prio, queue_buf_size * sizeof(double));
+    }
   }
 
+  q->fname = fname;
+  q->id = queued_paths;
+  q_len[q->id] = len;
+  q->depth = cur_depth + 1;
+  q->passed_det = passed_det;
+
+  if (q->depth > max_depth)
+    max_depth = q->depth;
+
+  queue_buf[q->id] = queue_top = q;
+
+  queued_paths++;
+
+  if (heap_sched)
+    sched_insert(q->id);
+  pending_not_fuzzed++;
+
+  cycles_wo_finds = 0;
+
   last_path_time = get_cur_time();
 }
 
@@ -1029,17 +1747,75 @@ static void add_to_queue(u8 *fname, u32 len, u8 passed_det)
 EXP_ST void destroy_queue(void)
 {
 
-  struct queue_entry *q = queue, *n;
+  u32 i;
 
-  while (q)
+  for (i = 0; i < queued_paths; i++)
   {
 
-    n = q->next;
-    ck_free(q->fname);
-    ck_free(q->trace_mini);
-    ck_free(q);
-    q = n;
+    ck_free(queue_buf[i]->fname);
+    ck_free(queue_buf[i]->trace_mini);
+    ck_free(queue_buf[i]);
   }
+
+  ck_free(queue_buf);
+  ck_free(q_favored);
+  ck_free(q_was_fuzzed);
+  ck_free(q_len);
+  ck_free(q_bitmap_size_d);
+  ck_free(q_exec_us);
+  ck_free(q_fuzz_cnt);
+  ck_free(sched_heap);
+  ck_free(sched_pos);
+  ck_free(sched_prio);
+}
+
+/* Make executor 'id' the one the globals refer to. Everything that runs or
+   inspects the director between two calls goes to that executor. */
+
+static void select_executor(u32 id)
+{
+
+  struct executor *e;
+
+  if (!execs || id == cur_exec)
+    return;
+
+  e = &execs[cur_exec];
+
+  e->trace_bits = trace_bits;
+  e->shm_fuzz = shm_fuzz;
+  e->out_file = out_file;
+  e->use_shm_fuzz = use_shm_fuzz;
+  e->child_timed_out = child_timed_out;
+  e->shm_id = shm_id;
+  e->shm_fuzz_id = shm_fuzz_id;
+  e->forksrv_pid = forksrv_pid;
+  e->child_pid = child_pid;
+  e->persist_pid = persist_pid;
+  e->out_fd = out_fd;
+  e->fsrv_ctl_fd = fsrv_ctl_fd;
+  e->fsrv_st_fd = fsrv_st_fd;
+  e->prev_timed_out = prev_timed_out;
+  e->child_start_us = child_start_us;
+
+  e = &execs[cur_exec = id];
+
+  trace_bits = e->trace_bits;
+  target_bits = trace_bits + map_size;
+  shm_fuzz = e->shm_fuzz;
+  out_file = e->out_file;
+  use_shm_fuzz = e->use_shm_fuzz;
+  child_timed_out = e->child_timed_out;
+  shm_id = e->shm_id;
+  shm_fuzz_id = e->shm_fuzz_id;
+  forksrv_pid = e->forksrv_pid;
+  child_pid = e->child_pid;
+  persist_pid = e->persist_pid;
+  out_fd = e->out_fd;
+  fsrv_ctl_fd = e->fsrv_ctl_fd;
+  fsrv_st_fd = e->fsrv_st_fd;
+  prev_timed_out = e->prev_timed_out;
+  child_start_us = e->child_start_us;
 }
 
 EXP_ST void stop_forkserver()
@@ -1051,6 +1827,38 @@ EXP_ST void stop_forkserver()
   close(fsrv_st_fd);
   if (waitpid(forksrv_pid, &status, 0) <= 0)
     PFATAL("Forkserver-stop waitpid() failed");
+  forksrv_pid = 0;
+
+  /* A child stopped between runs would otherwise be left behind. */
+
+  if (persist_pid > 0)
+    kill(persist_pid, SIGKILL);
+  persist_pid = 0;
+}
+
+static void drain_executors(void);
+
+/* Stop the forkservers of all executors that have one running. The
+   selected one is restarted by the caller; the others are started again
+   on their next run. */
+
+static void stop_executors(void)
+{
+
+  u32 i, me = cur_exec;
+
+  drain_executors();
+
+  for (i = 0; i < exec_cnt; i++)
+  {
+
+    select_executor(i);
+
+    if (forksrv_pid > 0)
+      stop_forkserver();
+  }
+
+  select_executor(me);
 }
 
 /* Write bitmap to file. The bitmap is useful mostly for the secret
@@ -1079,6 +1887,37 @@ EXP_ST void write_bitmap(void)
   ck_free(fname);
 }
 
+/* Recount slice_cvg[] from scratch. Only needed when virgin_bits is loaded
+   from a file (-B); has_new_bits() and has_new_modify() keep it up to
+   date. */
+
+static void count_slice_cvg(void)
+{
+
+  u32 i;
+
+  memset(slice_cvg, 0, sizeof(slice_cvg));
+
+  for (i = 0; i < map_size; i++)
+    if (virgin_bits[i] != 0xff)
+      slice_cvg[i < (map_size >> 2) ? 0 : i < (map_size >> 1) ? 1 : 2]++;
+}
+
+/* Count the bytes of a map word that are about to be covered for the first
+   time. */
+
+static inline u32 count_new_bytes(u8 *cur, u8 *vir, u32 len)
+{
+
+  u32 ret = 0;
+
+  while (len--)
+    if (cur[len] && vir[len] == 0xff)
+      ret++;
+
+  return ret;
+}
+
 /* Read bitmap from file. This is for the -B option again. */
 
 EXP_ST void read_bitmap(u8 *fname)
@@ -1094,145 +1933,152 @@ EXP_ST void read_bitmap(u8 *fname)
   close(fd);
 }
 
-static inline u8 has_new_modify(u8 *virgin_map)
+/* Go through the words of a map block where trace_bits and the virgin map
+   overlap: clear the bits in the virgin map, count the bytes that got covered
+   for the first time into *cvg, and raise 'ret' to 'hi' if there were any, or
+   to 'lo' if only hit counts changed. 'len' must be a multiple of 8. */
+
+static inline u8 scan_block(u8 *cur, u8 *vir, u32 len, u8 ret, u8 lo, u8 hi,
+                            u32 *cvg)
 {
 
-  u64 *current = (u64 *)trace_bits;
-  current = current + 2048;
-  u64 *virgin = (u64 *)virgin_map;
-  virgin = virgin + 2048;
+  u64 *current = (u64 *)cur;
+  u64 *virgin = (u64 *)vir;
 
-  u8 ret = 0;
+  len >>= 3;
 
-  for (int i = 0; i < 2048; i++)
+  while (len--)
   {
-    if (unlikely(*current))
+
+    if (unlikely(*current) && unlikely(*current & *virgin))
     {
-      if (ret < 1)
-      {
-        u8 *cur = (u8 *)current;
-        u8 *vir = (u8 *)virgin;
-        if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-            (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
-            (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
-            (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff))
-          ret = 1;
-      }
+
+      u32 n = count_new_bytes((u8 *)current, (u8 *)virgin, 8);
+
+      ret = MAX(ret, n ? hi : lo);
+      *cvg += n;
 
       *virgin &= ~*current;
     }
+
     current++;
     virgin++;
   }
+
   return ret;
 }
 
-/* Check if the current execution path brings anything new to the table.
-   Update virgin bits to reflect the finds. Returns 1 if the only change is
-   the hit-count for a particular tuple; 2 if there are new tuples seen.
-   Updates the map, so subsequent calls will always return 0.
+static u8 scan_slice_scalar(u8 *cur, u8 *vir, u32 len, u8 lo, u8 hi,
+                            u32 *cvg)
+{
 
-   This function is called after every exec() on a fairly large buffer, so
-   it needs to be fast. We do this in 32-bit and 64-bit flavors. */
+  return scan_block(cur, vir, len, 0, lo, hi, cvg);
+}
 
-static inline u8 has_new_bits(u8 *virgin_map)
+#ifdef HAVE_MAP_SIMD
+
+/* The SIMD versions only look for blocks where the two maps overlap and
+   leave the (rare) rest to scan_block(). 'len' must be a multiple of the
+   vector size. */
+
+__attribute__((target("avx2"))) static u8
+scan_slice_avx2(u8 *cur, u8 *vir, u32 len, u8 lo, u8 hi, u32 *cvg)
 {
 
-#ifdef WORD_SIZE_64
+  u8 ret = 0;
+  u32 i;
 
-  u64 *current = (u64 *)trace_bits;
-  u64 *virgin = (u64 *)virgin_map;
+  for (i = 0; i < len; i += 32)
+  {
 
-  u32 i = (MAP_SIZE >> 3);
+    __m256i c = _mm256_loadu_si256((__m256i *)(cur + i));
 
-#else
+    if (likely(_mm256_testz_si256(c, c)))
+      continue;
 
-  u32 *current = (u32 *)trace_bits;
-  u32 *virgin = (u32 *)virgin_map;
+    if (_mm256_testz_si256(c, _mm256_loadu_si256((__m256i *)(vir + i))))
+      continue;
 
-  u32 i = (MAP_SIZE >> 2);
+    ret = scan_block(cur + i, vir + i, 32, ret, lo, hi, cvg);
+  }
 
-#endif /* ^WORD_SIZE_64 */
+  return ret;
+}
+
+__attribute__((target("sse4.1"))) static u8
+scan_slice_sse41(u8 *cur, u8 *vir, u32 len, u8 lo, u8 hi, u32 *cvg)
+{
 
   u8 ret = 0;
+  u32 i;
 
-  while (i--)
+  for (i = 0; i < len; i += 16)
   {
-    // SAYF("%d ",i);
 
-    if (i >= 6144)
-    {
+    __m128i c = _mm_loadu_si128((__m128i *)(cur + i));
 
-      if (unlikely(*current) && unlikely(*current & *virgin))
-      {
+    if (likely(_mm_testz_si128(c, c)))
+      continue;
 
-        if (likely(ret < 4))
-        {
+    if (_mm_testz_si128(c, _mm_loadu_si128((__m128i *)(vir + i))))
+      continue;
 
-          u8 *cur = (u8 *)current;
-          u8 *vir = (u8 *)virgin;
+    ret = scan_block(cur + i, vir + i, 16, ret, lo, hi, cvg);
+  }
 
-#ifdef WORD_SIZE_64
+  return ret;
+}
 
-          if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-              (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
-              (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
-              (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff))
-            ret = 4;
-          else
-            ret = 3;
+#endif /* HAVE_MAP_SIMD */
 
-#else
+/* Slice scanner in use, see setup_map_kernels(). */
 
-          if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-              (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff))
-            ret = 4;
-          else
-            ret = 3;
+static u8 (*scan_slice)(u8 *cur, u8 *vir, u32 len, u8 lo, u8 hi,
+                        u32 *cvg) = scan_slice_scalar;
 
-#endif /* ^WORD_SIZE_64 */
-        }
-        *virgin &= ~*current;
-      }
-    }
+/* Check the middle slice (non-region to region transitions) for new tuples.
+   Returns 1 if there are any. */
 
-    else if (i < 4096)
-    {
-      if (unlikely(*current) && unlikely(*current & *virgin))
-      {
-        if (likely(ret < 2))
-        {
+static inline u8 has_new_modify(u8 *virgin_map)
+{
 
-          u8 *cur = (u8 *)current;
-          u8 *vir = (u8 *)virgin;
+  static u32 cvg_unused;
 
-#ifdef __x86_64__
+  PROF_SCOPE(PROF_HAS_NEW_BITS);
 
-          if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-              (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff) ||
-              (cur[4] && vir[4] == 0xff) || (cur[5] && vir[5] == 0xff) ||
-              (cur[6] && vir[6] == 0xff) || (cur[7] && vir[7] == 0xff))
-            ret = 2;
-          else
-            ret = 1;
+  return scan_slice(trace_bits + (map_size >> 2), virgin_map + (map_size >> 2),
+                    map_size >> 2, 0, 1,
+                    virgin_map == virgin_bits ? &slice_cvg[1] : &cvg_unused);
+}
 
-#else
+/* Check if the current execution path brings anything new to the table.
+   Update virgin bits to reflect the finds. In the outer slice, returns 1 if
+   the only change is the hit-count for a particular tuple and 2 if there are
+   new tuples seen; changes in the region slice take precedence and return 3
+   and 4, respectively. The middle slice is left to has_new_modify(). Updates
+   the map, so subsequent calls will always return 0.
 
-          if ((cur[0] && vir[0] == 0xff) || (cur[1] && vir[1] == 0xff) ||
-              (cur[2] && vir[2] == 0xff) || (cur[3] && vir[3] == 0xff))
-            ret = 2;
-          else
-            ret = 1;
+   This function is called after every exec() on a fairly large buffer, so
+   it needs to be fast. Each slice gets its own pass of scan_slice(). */
 
-#endif /* ^__x86_64__ */
-        }
-        *virgin &= ~*current;
-      }
-    }
+static inline u8 has_new_bits(u8 *virgin_map)
+{
 
-    current++;
-    virgin++;
-  }
+  static u32 cvg_unused[3];
+
+  PROF_SCOPE(PROF_HAS_NEW_BITS);
+
+  u32 *cvg = virgin_map == virgin_bits ? slice_cvg : cvg_unused;
+  u8 ret, ret_outer;
+
+  ret = scan_slice(trace_bits, virgin_map, map_size >> 2, 3, 4, &cvg[0]);
+
+  ret_outer = scan_slice(trace_bits + (map_size >> 1),
+                         virgin_map + (map_size >> 1), map_size >> 1, 1, 2,
+                         &cvg[2]);
+
+  if (!ret)
+    ret = ret_outer;
 
   if (ret && virgin_map == virgin_bits)
     bitmap_changed = 1;
@@ -1247,7 +2093,7 @@ static u32 count_bits(u8 *mem)
 {
 
   u32 *ptr = (u32 *)mem;
-  u32 i = (MAP_SIZE >> 2);
+  u32 i = (map_size >> 2);
   u32 ret = 0;
 
   while (i--)
@@ -1282,7 +2128,7 @@ static u32 count_bytes(u8 *mem)
 {
 
   u32 *ptr = (u32 *)mem;
-  u32 i = (MAP_SIZE >> 2);
+  u32 i = (map_size >> 2);
   u32 ret = 0;
 
   while (i--)
@@ -1309,7 +2155,7 @@ static u32 count_bytes_d(u8 *mem)
 {
 
   u32 *ptr = (u32 *)mem;
-  u32 i = (MAP_SIZE >> 4);
+  u32 i = (map_size >> 4);
   u32 ret = 0;
 
   while (i--)
@@ -1332,34 +2178,6 @@ static u32 count_bytes_d(u8 *mem)
   return ret;
 }
 
-static u32 count_virgin_bytes(u8 *mem)
-{
-
-  u32 *ptr = (u32 *)mem;
-  u32 i = (MAP_SIZE >> 4);
-  u32 ret = 0;
-
-  while (i--)
-  {
-
-    u32 v = *(ptr++);
-
-    if (v == 0xffffffff)
-      continue;
-
-    if ((v & FF(0)) != FF(0))
-      ret++;
-    if ((v & FF(1)) != FF(1))
-      ret++;
-    if ((v & FF(2)) != FF(2))
-      ret++;
-    if ((v & FF(3)) != FF(3))
-      ret++;
-  }
-
-  return ret;
-}
-
 /* Count the number of non-255 bytes set in the bitmap. Used strictly for the
    status screen, several calls per second or so. */
 
@@ -1367,7 +2185,7 @@ static u32 count_non_255_bytes(u8 *mem)
 {
 
   u32 *ptr = (u32 *)mem;
-  u32 i = (MAP_SIZE >> 2);
+  u32 i = (map_size >> 2);
   u32 ret = 0;
 
   while (i--)
@@ -1410,7 +2228,7 @@ static const u8 simplify_lookup[256] = {
 static void simplify_trace(u64 *mem)
 {
 
-  u32 i = MAP_SIZE >> 3;
+  u32 i = map_size >> 3;
 
   while (i--)
   {
@@ -1443,7 +2261,7 @@ static void simplify_trace(u64 *mem)
 static void simplify_trace(u32 *mem)
 {
 
-  u32 i = MAP_SIZE >> 2;
+  u32 i = map_size >> 2;
 
   while (i--)
   {
@@ -1506,7 +2324,7 @@ EXP_ST void init_count_class16(void)
 static inline void classify_counts(u64 *mem)
 {
 
-  u32 i = MAP_SIZE >> 3;
+  u32 i = map_size >> 3;
 
   while (i--)
   {
@@ -1533,7 +2351,7 @@ static inline void classify_counts(u64 *mem)
 static inline void classify_counts(u32 *mem)
 {
 
-  u32 i = MAP_SIZE >> 2;
+  u32 i = map_size >> 2;
 
   while (i--)
   {
@@ -1555,100 +2373,327 @@ static inline void classify_counts(u32 *mem)
 
 #endif /* ^WORD_SIZE_64 */
 
-/* Get rid of shared memory (atexit handler). */
-
-static void remove_shm(void)
+static void classify_counts_scalar(u8 *mem)
 {
 
-  shmctl(shm_id, IPC_RMID, NULL);
+#ifdef WORD_SIZE_64
+  classify_counts((u64 *)mem);
+#else
+  classify_counts((u32 *)mem);
+#endif /* ^WORD_SIZE_64 */
 }
 
-/* Compact trace bytes into a smaller bitmap. We effectively just drop the
-   count information here. This is called only sporadically, for some
-   new paths. */
+#ifdef HAVE_MAP_SIMD
 
-static void minimize_bits(u8 *dst, u8 *src)
+/* Vector versions of count_class_lookup8[]: the low nibble goes through a
+   shuffle table, and anything from 16 up is settled with unsigned compares
+   (max(x, c) == x means x >= c). */
+
+__attribute__((target("avx2"))) static void classify_counts_avx2(u8 *mem)
 {
 
-  u32 i = 0;
+  const __m256i lut = _mm256_setr_epi8(0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16,
+                                       16, 16, 16, 16, 0, 1, 2, 4, 8, 8, 8, 8,
+                                       16, 16, 16, 16, 16, 16, 16, 16);
+  const __m256i nibble = _mm256_set1_epi8(0x0f), c16 = _mm256_set1_epi8(16),
+                c32 = _mm256_set1_epi8(32), c64 = _mm256_set1_epi8(64),
+                c128 = _mm256_set1_epi8((char)128);
+  u32 i;
 
-  while (i < MAP_SIZE)
+  for (i = 0; i < map_size; i += 32)
   {
 
-    if (*(src++))
-      dst[i >> 3] |= 1 << (i & 7);
-    i++;
-  }
-}
+    __m256i x = _mm256_loadu_si256((__m256i *)(mem + i)), r;
 
-/* When we bump into a new path, we call this to see if the path appears
-   more "favorable" than any of the existing ones. The purpose of the
-   "favorables" is to have a minimal set of paths that trigger all the bits
-   seen in the bitmap so far, and focus on fuzzing them at the expense of
-   the rest.
+    if (likely(_mm256_testz_si256(x, x)))
+      continue;
 
-   The first step of the process is to maintain a list of top_rated[] entries
-   for every byte in the bitmap. We win that slot if there is no previous
-   contender, or if the contender has a more favorable speed x size factor. */
+    r = _mm256_shuffle_epi8(lut, _mm256_and_si256(x, nibble));
+    r = _mm256_blendv_epi8(r, c32,
+                           _mm256_cmpeq_epi8(_mm256_max_epu8(x, c16), x));
+    r = _mm256_blendv_epi8(r, c64,
+                           _mm256_cmpeq_epi8(_mm256_max_epu8(x, c32), x));
+    r = _mm256_blendv_epi8(r, c128,
+                           _mm256_cmpeq_epi8(_mm256_max_epu8(x, c128), x));
 
-static void update_bitmap_score(struct queue_entry *q)
+    _mm256_storeu_si256((__m256i *)(mem + i), r);
+  }
+}
+
+__attribute__((target("sse4.1"))) static void classify_counts_sse41(u8 *mem)
 {
 
+  const __m128i lut = _mm_setr_epi8(0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16,
+                                    16, 16, 16, 16);
+  const __m128i nibble = _mm_set1_epi8(0x0f), c16 = _mm_set1_epi8(16),
+                c32 = _mm_set1_epi8(32), c64 = _mm_set1_epi8(64),
+                c128 = _mm_set1_epi8((char)128);
   u32 i;
-  u64 fav_factor = q->exec_us * q->len;
 
-  /* For every byte set in trace_bits[], see if there is a previous winner,
-     and how it compares to us. */
+  for (i = 0; i < map_size; i += 16)
+  {
 
-  for (i = 0; i < MAP_SIZE; i++)
+    __m128i x = _mm_loadu_si128((__m128i *)(mem + i)), r;
 
-    if (trace_bits[i])
-    {
+    if (likely(_mm_testz_si128(x, x)))
+      continue;
 
-      if (top_rated[i])
-      {
+    r = _mm_shuffle_epi8(lut, _mm_and_si128(x, nibble));
+    r = _mm_blendv_epi8(r, c32, _mm_cmpeq_epi8(_mm_max_epu8(x, c16), x));
+    r = _mm_blendv_epi8(r, c64, _mm_cmpeq_epi8(_mm_max_epu8(x, c32), x));
+    r = _mm_blendv_epi8(r, c128, _mm_cmpeq_epi8(_mm_max_epu8(x, c128), x));
 
-        /* Faster-executing or smaller test cases are favored. */
-        if (q->bitmap_size_d < top_rated[i]->bitmap_size_d)
-          continue;
-        else if (q->bitmap_size_d == top_rated[i]->bitmap_size_d && fav_factor > top_rated[i]->exec_us * top_rated[i]->len)
-          continue;
-        // if (fav_factor > top_rated[i]->exec_us * top_rated[i]->len) continue;
-        /* Looks like we're going to win. Decrease ref count for the
-           previous winner, discard its trace_bits[] if necessary. */
+    _mm_storeu_si128((__m128i *)(mem + i), r);
+  }
+}
 
-        if (!--top_rated[i]->tc_ref)
-        {
-          ck_free(top_rated[i]->trace_mini);
-          top_rated[i]->trace_mini = 0;
-        }
-      }
+#endif /* HAVE_MAP_SIMD */
+
+/* Classifier in use, see setup_map_kernels(). */
+
+static void (*classify_map)(u8 *mem) = classify_counts_scalar;
+
+#ifdef HAVE_MAP_SIMD
+
+/* Run the kernels in use against the scalar ones on random maps of varying
+   density, and on the same slices has_new_bits() and has_new_modify() use.
+   Returns 0 on any difference in output, return value or coverage count. */
+
+static u8 check_map_kernels(void)
+{
+
+  const u32 slices[3][4] = {
+      {0, map_size >> 2, 3, 4},
+      {map_size >> 2, map_size >> 2, 0, 1},
+      {map_size >> 1, map_size >> 1, 1, 2}};
+
+  u8 *cur1 = ck_alloc(MAP_SIZE), *cur2 = ck_alloc(MAP_SIZE),
+     *vir1 = ck_alloc(MAP_SIZE), *vir2 = ck_alloc(MAP_SIZE);
+  u32 seed = HASH_CONST, round, i, k, cvg1, cvg2;
+  u8 ok = 1;
+
+#define XORSHIFT() (seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5)
+
+  for (round = 0; round < 32 && ok; round++)
+  {
+
+    /* From one hit in 2 bytes to one in 256; half of the virgin map is
+       untouched, the rest is random. */
+
+    u32 sparse = (2 << (round & 7)) - 1;
+
+    for (i = 0; i < MAP_SIZE; i++)
+    {
+      XORSHIFT();
+      cur1[i] = (seed & sparse) ? 0 : (seed >> 24);
+      vir1[i] = (seed & 0x100) ? 0xff : (seed >> 16);
+    }
+
+    memcpy(cur2, cur1, MAP_SIZE);
+    memcpy(vir2, vir1, MAP_SIZE);
+
+    classify_counts_scalar(cur1);
+    classify_map(cur2);
+
+    if (memcmp(cur1, cur2, MAP_SIZE))
+      ok = 0;
+
+    for (k = 0; k < 3 && ok; k++)
+    {
+
+      u32 off = slices[k][0], len = slices[k][1];
+
+      cvg1 = cvg2 = 0;
+
+      if (scan_slice_scalar(cur1 + off, vir1 + off, len, slices[k][2],
+                            slices[k][3], &cvg1) !=
+              scan_slice(cur1 + off, vir2 + off, len, slices[k][2],
+                         slices[k][3], &cvg2) ||
+          cvg1 != cvg2 || memcmp(vir1 + off, vir2 + off, len))
+        ok = 0;
+    }
+  }
+
+#undef XORSHIFT
+
+  ck_free(cur1);
+  ck_free(cur2);
+  ck_free(vir1);
+  ck_free(vir2);
+
+  return ok;
+}
+
+#endif /* HAVE_MAP_SIMD */
+
+/* Pick the fastest map kernels the CPU supports, unless AFL_NO_SIMD is set.
+   The SIMD ones only get used if check_map_kernels() is happy with them. */
+
+static void setup_map_kernels(void)
+{
+
+#ifdef HAVE_MAP_SIMD
+
+  u8 *name;
+
+  if (getenv("AFL_NO_SIMD"))
+    return;
+
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+  {
+    classify_map = classify_counts_avx2;
+    scan_slice = scan_slice_avx2;
+    name = "AVX2";
+  }
+  else if (__builtin_cpu_supports("sse4.1"))
+  {
+    classify_map = classify_counts_sse41;
+    scan_slice = scan_slice_sse41;
+    name = "SSE4.1";
+  }
+  else
+    return;
+
+  if (!check_map_kernels())
+  {
+
+    WARNF("The %s map kernels disagree with the scalar ones, not using them.",
+          name);
+
+    classify_map = classify_counts_scalar;
+    scan_slice = scan_slice_scalar;
+    return;
+  }
+
+  OKF("Using %s map kernels.", name);
+
+#endif /* HAVE_MAP_SIMD */
+}
+
+/* Get rid of shared memory (atexit handler). */
+
+static void remove_shm(void)
+{
+
+  u32 i;
+
+  shmctl(shm_id, IPC_RMID, NULL);
+
+  if (shm_fuzz_id >= 0)
+    shmctl(shm_fuzz_id, IPC_RMID, NULL);
+
+  for (i = 0; execs && i < exec_cnt; i++)
+  {
+
+    if (execs[i].shm_id == shm_id)
+      continue;
+
+    shmctl(execs[i].shm_id, IPC_RMID, NULL);
+    shmctl(execs[i].shm_fuzz_id, IPC_RMID, NULL);
+  }
+}
+
+/* Compact trace bytes into a sorted list of the indices that were hit,
+   dropping the count information. Traces are sparse, so we skip over empty
+   words; returns the number of indices written to dst. */
+
+#if MAP_SIZE_POW2 > 16
+#error "trace_mini holds 16-bit map indices"
+#endif /* MAP_SIZE_POW2 > 16 */
+
+static u32 minimize_bits(u16 *dst, u8 *src)
+{
+
+  u64 *w = (u64 *)src;
+  u32 i, j, n = 0;
+
+  for (i = 0; i < (map_size >> 3); i++)
+  {
+
+    if (!w[i])
+      continue;
+
+    for (j = i << 3; j < (i << 3) + 8; j++)
+      if (src[j])
+        dst[n++] = j;
+  }
+
+  return n;
+}
+
+/* When we bump into a new path, we call this to see if the path appears
+   more "favorable" than any of the existing ones. The purpose of the
+   "favorables" is to have a minimal set of paths that trigger all the bits
+   seen in the bitmap so far, and focus on fuzzing them at the expense of
+   the rest.
+
+   The first step of the process is to maintain a list of top_rated[] entries
+   for every byte in the bitmap. We win that slot if there is no previous
+   contender, or if the contender has a more favorable speed x size factor. */
 
-      /* Insert ourselves as the new winner. */
+static void update_bitmap_score(struct queue_entry *q)
+{
+
+  static u16 idx[MAP_SIZE];
+  u32 i, k, cnt = minimize_bits(idx, trace_bits);
+  u64 fav_factor = q_exec_us[q->id] * q_len[q->id];
+
+  /* For every byte set in trace_bits[], see if there is a previous winner,
+     and how it compares to us. */
+
+  for (k = 0; k < cnt; k++)
+  {
 
-      top_rated[i] = q;
-      q->tc_ref++;
+    i = idx[k];
 
-      if (!q->trace_mini)
+    if (top_rated[i])
+    {
+
+      /* Faster-executing or smaller test cases are favored. */
+      if (q_bitmap_size_d[q->id] < q_bitmap_size_d[top_rated[i]->id])
+        continue;
+      else if (q_bitmap_size_d[q->id] == q_bitmap_size_d[top_rated[i]->id] && fav_factor > q_exec_us[top_rated[i]->id] * q_len[top_rated[i]->id])
+        continue;
+      // if (fav_factor > q_exec_us[top_rated[i]->id] * q_len[top_rated[i]->id]) continue;
+      /* Looks like we're going to win. Decrease ref count for the
+         previous winner, discard its trace_bits[] if necessary. */
+
+      if (!--top_rated[i]->tc_ref)
       {
-        q->trace_mini = ck_alloc(MAP_SIZE >> 3);
-        minimize_bits(q->trace_mini, trace_bits);
+        ck_free(top_rated[i]->trace_mini);
+        top_rated[i]->trace_mini = 0;
       }
+    }
+
+    /* Insert ourselves as the new winner. */
+
+    top_rated[i] = q;
+    q->tc_ref++;
 
-      score_changed = 1;
+    if (!q->trace_mini)
+    {
+      q->trace_mini = ck_alloc_nozero(cnt * sizeof(u16));
+      memcpy(q->trace_mini, idx, cnt * sizeof(u16));
+      q->mini_cnt = cnt;
     }
+
+    score_changed = 1;
+  }
 }
 
 static void cull_queue(void)
 {
 
-  struct queue_entry *q;
   static u8 temp_v[MAP_SIZE >> 3];
   u32 i;
 
   if (dumb_mode || !score_changed)
     return;
 
+  PROF_SCOPE(PROF_CULL);
+
   score_changed = 0;
 
   memset(temp_v, 255, MAP_SIZE >> 3);
@@ -1656,32 +2701,26 @@ static void cull_queue(void)
   queued_favored = 0;
   pending_favored = 0;
 
-  q = queue;
-
-  while (q)
-  {
-    q->favored = 0;
-    q = q->next;
-  }
+  memset(q_favored, 0, queued_paths);
 
   /* Let's see if anything in the bitmap isn't captured in temp_v.
      If yes, and if it has a top_rated[] contender, let's use it. */
 
-  for (i = 0; i < MAP_SIZE; i++)
+  for (i = 0; i < map_size; i++)
     if (top_rated[i] && (temp_v[i >> 3] & (1 << (i & 7))))
     {
 
-      u32 j = MAP_SIZE >> 3;
+      u16 *m = top_rated[i]->trace_mini;
+      u32 j = top_rated[i]->mini_cnt;
 
       /* Remove all bits belonging to the current entry from temp_v. */
 
       while (j--)
-        if (top_rated[i]->trace_mini[j])
-          temp_v[j] &= ~top_rated[i]->trace_mini[j];
+        temp_v[m[j] >> 3] &= ~(1 << (m[j] & 7));
 
-      if (i < MAP_SIZE >> 2)
+      if (i < map_size >> 2)
       {
-        top_rated[i]->favored = 1;
+        q_favored[top_rated[i]->id] = 1;
         queued_favored++;
       }
       else
@@ -1689,28 +2728,26 @@ static void cull_queue(void)
         // u64 cur_ms = get_cur_time();
         // u64 t = (cur_ms - start_time) / 1000;
         // double progress_to_tx = ((double) t) / ((double) 45 * 60.0);  //tx=45m
-        u64 edges_cur = count_virgin_bytes(virgin_bits);
+        u64 edges_cur = slice_cvg[0];
         double progress_to_tx = ((double)edges_cur) / ((double)total_edges * threshold);
 
         u8 random_num = rand() % 10;
         if (random_num > progress_to_tx * 10)
         {
-          top_rated[i]->favored = 1;
+          q_favored[top_rated[i]->id] = 1;
           queued_favored++;
         }
       }
 
-      if (!top_rated[i]->was_fuzzed)
+      if (!q_was_fuzzed[top_rated[i]->id])
         pending_favored++;
     }
 
-  q = queue;
+  for (i = 0; i < queued_paths; i++)
+    mark_as_redundant(queue_buf[i], !q_favored[i]);
 
-  while (q)
-  {
-    mark_as_redundant(q, !q->favored);
-    q = q->next;
-  }
+  if (heap_sched)
+    sched_rebuild();
 }
 
 /* The second part of the mechanism discussed above is a routine that
@@ -1728,11 +2765,14 @@ EXP_ST void setup_shm(void)
 
   if (!in_bitmap)
     memset(virgin_bits, 255, MAP_SIZE);
+  else
+    count_slice_cvg();
 
   memset(virgin_tmout, 255, MAP_SIZE);
   memset(virgin_crash, 255, MAP_SIZE);
 
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+  shm_id = shmget(IPC_PRIVATE, map_size + PDGF_MAX_TARGETS,
+                  IPC_CREAT | IPC_EXCL | 0600);
 
   if (shm_id < 0)
     PFATAL("shmget() failed");
@@ -1755,6 +2795,169 @@ EXP_ST void setup_shm(void)
 
   if (trace_bits == (void *)-1)
     PFATAL("shmat() failed");
+
+  target_bits = trace_bits + map_size;
+
+  if (dumb_mode)
+    return;
+
+  /* Offer the target a region to take testcases from. Harnesses that use
+     __AFL_FUZZ_TESTCASE_BUF say so in the forkserver hello; everyone else
+     keeps reading stdin or the @@ file. */
+
+  shm_fuzz_id = shmget(IPC_PRIVATE, sizeof(u32) + MAX_FILE,
+                       IPC_CREAT | IPC_EXCL | 0600);
+
+  if (shm_fuzz_id < 0)
+    PFATAL("shmget() failed");
+
+  shm_str = alloc_printf("%d", shm_fuzz_id);
+  setenv(SHM_FUZZ_ENV_VAR, shm_str, 1);
+  ck_free(shm_str);
+
+  shm_fuzz = shmat(shm_fuzz_id, NULL, 0);
+
+  if (shm_fuzz == (void *)-1)
+    PFATAL("shmat() failed");
+}
+
+/* Set up executors 1 and up for -j. Each gets a trace map and shm_fuzz
+   region of its own, and its own copy of the input: a .cur_input_<n> file
+   for stdin, a file next to it for @@, or another memfd, which its
+   forkserver moves to MEMFD_INPUT_FD. The checker stays on executor 0. */
+
+static void setup_executors(void)
+{
+
+  u8 *cwd, *out_abs = NULL, *dir_abs, *fn;
+  u32 argc = 0, i, k;
+
+  if (!execs)
+    return;
+
+  execs[0].shm_id = shm_id;
+  execs[0].shm_fuzz_id = shm_fuzz_id;
+  execs[0].argv = director_argv;
+
+  /* Executor 0's stdin file must not leak into the other directors: in
+     snapshot mode, each of them would rewind it after every run. */
+
+  if (!out_file)
+    fcntl(out_fd, F_SETFD, FD_CLOEXEC);
+
+  while (director_argv[argc])
+    argc++;
+
+  cwd = (u8 *)getcwd(NULL, 0);
+  dir_abs = (u8 *)realpath((char *)out_dir, NULL);
+
+  if (!cwd || !dir_abs)
+    PFATAL("Unable to resolve '%s'", out_dir);
+
+  /* detect_file_args() substituted @@ with the absolute path. */
+
+  if (out_file && !memfd_input)
+  {
+
+    if (out_file[0] == '/')
+      out_abs = ck_strdup(out_file);
+    else
+      out_abs = alloc_printf("%s/%s", cwd, out_file);
+
+    for (i = 1; i < argc; i++)
+      if (strstr(director_argv[i], (char *)out_abs))
+        break;
+
+    if (i == argc)
+      FATAL("-j needs @@ in the command line when -f is used");
+  }
+
+  for (k = 1; k < exec_cnt; k++)
+  {
+
+    struct executor *e = &execs[k];
+
+    e->shm_id = shmget(IPC_PRIVATE, map_size + PDGF_MAX_TARGETS,
+                       IPC_CREAT | IPC_EXCL | 0600);
+
+    if (e->shm_id < 0)
+      PFATAL("shmget() failed");
+
+    e->trace_bits = shmat(e->shm_id, NULL, 0);
+
+    if (e->trace_bits == (void *)-1)
+      PFATAL("shmat() failed");
+
+    e->shm_fuzz_id = shmget(IPC_PRIVATE, sizeof(u32) + MAX_FILE,
+                            IPC_CREAT | IPC_EXCL | 0600);
+
+    if (e->shm_fuzz_id < 0)
+      PFATAL("shmget() failed");
+
+    e->shm_fuzz = shmat(e->shm_fuzz_id, NULL, 0);
+
+    if (e->shm_fuzz == (void *)-1)
+      PFATAL("shmat() failed");
+
+    e->argv = ck_alloc((argc + 1) * sizeof(char *));
+    memcpy(e->argv, director_argv, argc * sizeof(char *));
+
+    e->child_pid = -1;
+    e->out_fd = -1;
+
+    if (memfd_input)
+    {
+
+      e->out_fd = memfd_create("pdgf_input", MFD_CLOEXEC);
+
+      if (e->out_fd < 0)
+        PFATAL("memfd_create() failed");
+
+      e->out_file = out_file;
+    }
+    else if (out_file)
+    {
+
+      /* Keep the name at the end, in case the target cares about it. */
+
+      e->out_file = alloc_printf("%s/.cur_input_%u_%s", dir_abs, k,
+                                 basename((char *)out_abs));
+
+      for (i = 1; i < argc; i++)
+      {
+
+        u8 *loc = (u8 *)strstr(director_argv[i], (char *)out_abs);
+
+        if (!loc)
+          continue;
+
+        *loc = 0;
+        e->argv[i] = (char *)alloc_printf("%s%s%s", director_argv[i],
+                                          e->out_file, loc + strlen(out_abs));
+        *loc = out_abs[0];
+      }
+    }
+    else
+    {
+
+      fn = alloc_printf("%s/.cur_input_%u", out_dir, k);
+
+      unlink(fn); /* Ignore errors */
+
+      e->out_fd = open(fn, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+
+      if (e->out_fd < 0)
+        PFATAL("Unable to create '%s'", fn);
+
+      ck_free(fn);
+    }
+  }
+
+  ck_free(out_abs);
+  free(dir_abs);
+  free(cwd);
+
+  OKF("Running the director as %u executors.", exec_cnt);
 }
 
 /* Load postprocessor, if available. */
@@ -2381,6 +3584,77 @@ static void destroy_extras(void)
   ck_free(a_extras);
 }
 
+/* Wait until fd has something to read, or timeout_us runs out (returns 0).
+   The timeout is a timerfd polled alongside fd, so it takes neither SIGALRM
+   nor millisecond rounding. Ctrl+C counts as a timeout, so that the caller
+   kills whatever it's waiting for rather than blocking on it. */
+
+static u8 wait_readable(s32 fd, u64 timeout_us)
+{
+
+  static s32 tmout_fd = -1;
+
+  struct itimerspec its;
+  struct pollfd pfd[2];
+  u8 ret = 1;
+
+  if (tmout_fd < 0)
+  {
+    tmout_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tmout_fd < 0)
+      PFATAL("timerfd_create() failed");
+  }
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = timeout_us / 1000000;
+  its.it_value.tv_nsec = (timeout_us % 1000000) * 1000 + !timeout_us;
+
+  if (timerfd_settime(tmout_fd, 0, &its, NULL))
+    PFATAL("timerfd_settime() failed");
+
+  pfd[0].fd = fd;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = tmout_fd;
+  pfd[1].events = POLLIN;
+
+  while (1)
+  {
+
+    if (poll(pfd, 2, -1) < 0)
+    {
+
+      if (errno != EINTR)
+        PFATAL("poll() failed");
+
+      if (stop_soon)
+      {
+        ret = 0;
+        break;
+      }
+
+      continue;
+    }
+
+    /* EOF and errors are left for the caller's read() to report. */
+
+    if (pfd[0].revents)
+      break;
+
+    if (pfd[1].revents)
+    {
+      ret = 0;
+      break;
+    }
+  }
+
+  /* Disarming also drops any expiration we didn't read. */
+
+  memset(&its, 0, sizeof(its));
+  timerfd_settime(tmout_fd, 0, &its, NULL);
+
+  return ret;
+}
+
 /* Spin up fork server (instrumented mode only). The idea is explained here:
 
    http://lcamtuf.blogspot.com/2014/10/fuzzing-binaries-without-execve.html
@@ -2392,13 +3666,15 @@ static void destroy_extras(void)
 EXP_ST void init_forkserver(char **argv)
 {
 
-  static struct itimerval it;
   int st_pipe[2], ctl_pipe[2];
   int status;
   s32 rlen;
 
   // ACTF("Spinning up the fork server...");
 
+  if (execs)
+    argv = execs[cur_exec].argv;
+
   if (pipe(st_pipe) || pipe(ctl_pipe))
     PFATAL("pipe() failed");
 
@@ -2469,24 +3745,56 @@ EXP_ST void init_forkserver(char **argv)
       close(out_fd);
     }
 
-    /* Set up control and status pipes, close the unneeded original fds. */
+    /* Other executors point their director at their own map, testcase
+       region and memfd, and at a core of their own. */
 
-    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0)
-      PFATAL("dup2() failed");
-    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0)
-      PFATAL("dup2() failed");
+    if (execs)
+    {
 
-    close(ctl_pipe[0]);
-    close(ctl_pipe[1]);
-    close(st_pipe[0]);
-    close(st_pipe[1]);
+      u8 *shm_str = alloc_printf("%d", shm_id);
+      setenv(SHM_ENV_VAR, shm_str, 1);
+      ck_free(shm_str);
 
-    close(out_dir_fd);
-    close(dev_null_fd);
-    close(dev_urandom_fd);
-    close(fileno(plot_file));
+      shm_str = alloc_printf("%d", shm_fuzz_id);
+      setenv(SHM_FUZZ_ENV_VAR, shm_str, 1);
+      ck_free(shm_str);
 
-    /* This should improve performance a bit, since it stops the linker from
+      if (memfd_input && out_fd != MEMFD_INPUT_FD)
+        dup2(out_fd, MEMFD_INPUT_FD);
+
+#ifdef HAVE_AFFINITY
+
+      if (execs[cur_exec].cpu >= 0)
+      {
+
+        cpu_set_t c;
+
+        CPU_ZERO(&c);
+        CPU_SET(execs[cur_exec].cpu, &c);
+        sched_setaffinity(0, sizeof(c), &c); /* Ignore errors */
+      }
+
+#endif /* HAVE_AFFINITY */
+    }
+
+    /* Set up control and status pipes, close the unneeded original fds. */
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0)
+      PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0)
+      PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(out_dir_fd);
+    close(dev_null_fd);
+    close(dev_urandom_fd);
+    close(fileno(plot_file));
+
+    /* This should improve performance a bit, since it stops the linker from
        doing extra work post-fork(). */
 
     if (!getenv("LD_BIND_LAZY"))
@@ -2527,25 +3835,33 @@ EXP_ST void init_forkserver(char **argv)
   fsrv_ctl_fd = ctl_pipe[1];
   fsrv_st_fd = st_pipe[0];
 
-  /* Wait for the fork server to come up, but don't wait too long. */
+  fcntl(fsrv_ctl_fd, F_SETFD, FD_CLOEXEC);
+  fcntl(fsrv_st_fd, F_SETFD, FD_CLOEXEC);
 
-  it.it_value.tv_sec = ((exec_tmout * FORK_WAIT_MULT) / 1000);
-  it.it_value.tv_usec = ((exec_tmout * FORK_WAIT_MULT) % 1000) * 1000;
+  /* Wait for the fork server to come up, but don't wait too long. */
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  if (!wait_readable(fsrv_st_fd, exec_tmout_us * FORK_WAIT_MULT))
+  {
+    child_timed_out = 1;
+    kill(forksrv_pid, SIGKILL);
+  }
 
   rlen = read(fsrv_st_fd, &status, 4);
 
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
-
-  setitimer(ITIMER_REAL, &it, NULL);
-
   /* If we have a four-byte "hello" message from the server, we're all set.
      Otherwise, try to figure out what went wrong. */
 
   if (rlen == 4)
   {
+
+    u32 target_map = status & ~(FORKSRV_MAP_HELLO | FORKSRV_SHM_FUZZ);
+
+    if ((status & FORKSRV_MAP_HELLO) && target_map != map_size)
+      FATAL("The target uses a %u-byte map, but afl-fuzz expected %u bytes",
+            target_map, map_size);
+
+    use_shm_fuzz = (status & FORKSRV_MAP_HELLO) && (status & FORKSRV_SHM_FUZZ);
+
     // OKF("All right - fork server is up.");
     return;
   }
@@ -2684,247 +4000,309 @@ EXP_ST void init_forkserver(char **argv)
   FATAL("Fork server handshake failed");
 }
 
-/* Execute target application, monitoring for timeouts. Return status
-   information. The called program will update trace_bits[]. */
+/* Classify the outcome of a run that ended with 'status'. Shared by
+   run_target() and reap_target(). */
 
-static u8 run_target(char **argv, u32 timeout)
+static u8 finish_target(int status, u64 timeout)
 {
 
-  static struct itimerval it;
-  static u32 prev_timed_out = 0;
-  static u64 exec_ms = 0;
-
-  int status = 0;
+  u64 exec_us = get_cur_time_us() - child_start_us;
   u32 tb4;
 
-  child_timed_out = 0;
+  last_exec_us = exec_us;
 
-  /* After this memset, trace_bits[] are effectively volatile, so we
-     must prevent any earlier operations from venturing into that
-     territory. */
+  if (!WIFSTOPPED(status))
+    child_pid = 0;
+
+  persist_pid = child_pid;
+
+  total_execs++;
+
+  /* Any subsequent operations on trace_bits must not be moved by the
+     compiler below this point. Past this location, trace_bits[] behave
+     very normally and do not have to be treated as volatile. */
 
-  memset(trace_bits, 0, MAP_SIZE);
   MEM_BARRIER();
 
-  /* If we're running in "dumb" mode, we can't rely on the fork server
-     logic compiled into the target program, so we will just keep calling
-     execve(). There is a bit of code duplication between here and
-     init_forkserver(), but c'est la vie. */
+  tb4 = *(u32 *)trace_bits;
 
-  if (dumb_mode == 1 || no_forkserver)
+  classify_map(trace_bits);
+
+  prev_timed_out = child_timed_out;
+
+  /* Report outcome to caller. */
+
+  if (WIFSIGNALED(status) && !stop_soon)
   {
 
-    child_pid = fork();
+    kill_signal = WTERMSIG(status);
 
-    if (child_pid < 0)
-      PFATAL("fork() failed");
+    if (child_timed_out && kill_signal == SIGKILL)
+      return FAULT_TMOUT;
 
-    if (!child_pid)
-    {
+    return FAULT_CRASH;
+  }
 
-      struct rlimit r;
+  /* A somewhat nasty hack for MSAN, which doesn't support abort_on_error and
+     must use a special exit code. */
 
-      if (mem_limit)
-      {
+  if (uses_asan && WEXITSTATUS(status) == MSAN_ERROR)
+  {
+    kill_signal = 0;
+    return FAULT_CRASH;
+  }
 
-        r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+  if ((dumb_mode == 1 || no_forkserver) && tb4 == EXEC_FAIL_SIG)
+    return FAULT_ERROR;
 
-#ifdef RLIMIT_AS
+  /* It makes sense to account for the slowest units only if the testcase was run
+  under the user defined timeout. */
+  if (!(timeout > exec_tmout_us) && (slowest_exec_ms < exec_us / 1000))
+  {
+    slowest_exec_ms = exec_us / 1000;
+  }
 
-        setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+  return FAULT_NONE;
+}
 
-#else
+/* Have the selected executor's forkserver start a run, starting it first
+   if need be. Returns 0 if we're stopping. */
+
+static u8 launch_target(char **argv)
+{
 
-        setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+  s32 res;
 
-#endif /* ^RLIMIT_AS */
-      }
+  if (!forksrv_pid)
+    init_forkserver(argv);
 
-      r.rlim_max = r.rlim_cur = 0;
+  child_timed_out = 0;
 
-      setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+  /* After this memset, trace_bits[] are effectively volatile, so we
+     must prevent any earlier operations from venturing into that
+     territory. */
 
-      /* Isolate the process and configure standard descriptors. If out_file is
-         specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
+  memset(trace_bits, 0, map_size + PDGF_MAX_TARGETS);
+  MEM_BARRIER();
 
-      setsid();
+  /* We have the fork server up and running, so simply tell it to have at
+     it, and then read back PID. */
 
-      dup2(dev_null_fd, 1);
-      dup2(dev_null_fd, 2);
+  if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4)
+  {
 
-      if (out_file)
-      {
+    if (stop_soon)
+      return 0;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  }
 
-        dup2(dev_null_fd, 0);
-      }
-      else
-      {
+  if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4)
+  {
 
-        dup2(out_fd, 0);
-        close(out_fd);
-      }
+    if (stop_soon)
+      return 0;
+    RPFATAL(res, "Unable to request new process from fork server (OOM?)");
+  }
 
-      /* On Linux, would be faster to use O_CLOEXEC. Maybe TODO. */
+  if (child_pid <= 0)
+    FATAL("Fork server is misbehaving (OOM?)");
 
-      close(dev_null_fd);
-      close(out_dir_fd);
-      close(dev_urandom_fd);
-      close(fileno(plot_file));
+  child_start_us = get_cur_time_us();
 
-      /* Set sane defaults for ASAN if nothing else specified. */
+  return 1;
+}
 
-      setenv("ASAN_OPTIONS", "abort_on_error=1:"
-                             "detect_leaks=0:"
-                             "symbolize=0:"
-                             "allocator_may_return_null=1",
-             0);
+/* Wait for the run started by launch_target() to finish, killing the child
+   once 'timeout' microseconds have passed since it started, and classify
+   it. With several executors, some of that time may already be gone. */
 
-      setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
-                                                                "symbolize=0:"
-                                                                "msan_track_origins=0",
-             0);
+static u8 reap_target(u64 timeout)
+{
 
-      execv(director_path, argv);
+  u64 spent = get_cur_time_us() - child_start_us;
+  int status = 0;
+  s32 res;
 
-      /* Use a distinctive bitmap value to tell the parent about execv()
-         falling through. */
+  /* The forkserver reports the status once the child is gone, killed by
+     us or not. */
 
-      *(u32 *)trace_bits = EXEC_FAIL_SIG;
-      exit(0);
-    }
+  if (!wait_readable(fsrv_st_fd, spent < timeout ? timeout - spent : 0))
+  {
+    child_timed_out = 1;
+    kill(child_pid, SIGKILL);
   }
-  else
+
+  if ((res = read(fsrv_st_fd, &status, 4)) != 4)
   {
 
-    s32 res;
+    if (stop_soon)
+      return 0;
+    RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+  }
 
-    /* In non-dumb mode, we have the fork server up and running, so simply
-       tell it to have at it, and then read back PID. */
+  return finish_target(status, timeout);
+}
 
-    if ((res = write(fsrv_ctl_fd, &prev_timed_out, 4)) != 4)
-    {
+/* Execute target application, monitoring for timeouts. Return status
+   information. The called program will update trace_bits[]. The timeout
+   is in microseconds. */
 
-      if (stop_soon)
-        return 0;
-      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
-    }
+static u8 run_target(char **argv, u64 timeout)
+{
 
-    if ((res = read(fsrv_st_fd, &child_pid, 4)) != 4)
-    {
+  static struct itimerval it;
 
-      if (stop_soon)
-        return 0;
-      RPFATAL(res, "Unable to request new process from fork server (OOM?)");
-    }
+  PROF_SCOPE(PROF_RUN_TARGET);
+
+  int status = 0;
+
+  /* In non-dumb mode, the forkserver does the heavy lifting. */
+
+  if (dumb_mode != 1 && !no_forkserver)
+  {
 
-    if (child_pid <= 0)
-      FATAL("Fork server is misbehaving (OOM?)");
+    if (!launch_target(argv))
+      return 0;
+
+    return reap_target(timeout);
   }
 
-  /* Configure timeout, as requested by user, then wait for child to terminate. */
+  /* Otherwise, we can't rely on the fork server logic compiled into the
+     target program, so we will just keep calling execve(). There is a bit
+     of code duplication between here and init_forkserver(), but c'est la
+     vie. */
 
-  it.it_value.tv_sec = (timeout / 1000);
-  it.it_value.tv_usec = (timeout % 1000) * 1000;
+  child_timed_out = 0;
 
-  setitimer(ITIMER_REAL, &it, NULL);
+  memset(trace_bits, 0, map_size + PDGF_MAX_TARGETS);
+  MEM_BARRIER();
 
-  /* The SIGALRM handler simply kills the child_pid and sets child_timed_out. */
+  child_pid = fork();
 
-  if (dumb_mode == 1 || no_forkserver)
-  {
+  if (child_pid < 0)
+    PFATAL("fork() failed");
 
-    if (waitpid(child_pid, &status, 0) <= 0)
-      PFATAL("waitpid() failed");
-  }
-  else
+  if (!child_pid)
   {
 
-    s32 res;
+    struct rlimit r;
 
-    if ((res = read(fsrv_st_fd, &status, 4)) != 4)
+    if (mem_limit)
     {
 
-      if (stop_soon)
-        return 0;
-      RPFATAL(res, "Unable to communicate with fork server (OOM?)");
+      r.rlim_max = r.rlim_cur = ((rlim_t)mem_limit) << 20;
+
+#ifdef RLIMIT_AS
+
+      setrlimit(RLIMIT_AS, &r); /* Ignore errors */
+
+#else
+
+      setrlimit(RLIMIT_DATA, &r); /* Ignore errors */
+
+#endif /* ^RLIMIT_AS */
     }
-  }
 
-  if (!WIFSTOPPED(status))
-    child_pid = 0;
+    r.rlim_max = r.rlim_cur = 0;
 
-  getitimer(ITIMER_REAL, &it);
-  exec_ms = (u64)timeout - (it.it_value.tv_sec * 1000 +
-                            it.it_value.tv_usec / 1000);
+    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
 
-  it.it_value.tv_sec = 0;
-  it.it_value.tv_usec = 0;
+    /* Isolate the process and configure standard descriptors. If out_file is
+       specified, stdin is /dev/null; otherwise, out_fd is cloned instead. */
 
-  setitimer(ITIMER_REAL, &it, NULL);
+    setsid();
 
-  total_execs++;
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
 
-  /* Any subsequent operations on trace_bits must not be moved by the
-     compiler below this point. Past this location, trace_bits[] behave
-     very normally and do not have to be treated as volatile. */
+    if (out_file)
+    {
 
-  MEM_BARRIER();
+      dup2(dev_null_fd, 0);
+    }
+    else
+    {
 
-  tb4 = *(u32 *)trace_bits;
+      dup2(out_fd, 0);
+      close(out_fd);
+    }
 
-#ifdef WORD_SIZE_64
-  classify_counts((u64 *)trace_bits);
-#else
-  classify_counts((u32 *)trace_bits);
-#endif /* ^WORD_SIZE_64 */
+    /* On Linux, would be faster to use O_CLOEXEC. Maybe TODO. */
 
-  prev_timed_out = child_timed_out;
+    close(dev_null_fd);
+    close(out_dir_fd);
+    close(dev_urandom_fd);
+    close(fileno(plot_file));
 
-  /* Report outcome to caller. */
+    /* Set sane defaults for ASAN if nothing else specified. */
 
-  if (WIFSIGNALED(status) && !stop_soon)
-  {
+    setenv("ASAN_OPTIONS", "abort_on_error=1:"
+                           "detect_leaks=0:"
+                           "symbolize=0:"
+                           "allocator_may_return_null=1",
+           0);
 
-    kill_signal = WTERMSIG(status);
+    setenv("MSAN_OPTIONS", "exit_code=" STRINGIFY(MSAN_ERROR) ":"
+                                                              "symbolize=0:"
+                                                              "msan_track_origins=0",
+           0);
 
-    if (child_timed_out && kill_signal == SIGKILL)
-      return FAULT_TMOUT;
+    execv(director_path, argv);
 
-    return FAULT_CRASH;
+    /* Use a distinctive bitmap value to tell the parent about execv()
+       falling through. */
+
+    *(u32 *)trace_bits = EXEC_FAIL_SIG;
+    exit(0);
   }
 
-  /* A somewhat nasty hack for MSAN, which doesn't support abort_on_error and
-     must use a special exit code. */
+  /* Wait for the child to terminate, killing it if it takes longer than
+     the timeout allows. The SIGALRM handler simply kills the child_pid and
+     sets child_timed_out. */
 
-  if (uses_asan && WEXITSTATUS(status) == MSAN_ERROR)
-  {
-    kill_signal = 0;
-    return FAULT_CRASH;
-  }
+  child_start_us = get_cur_time_us();
 
-  if ((dumb_mode == 1 || no_forkserver) && tb4 == EXEC_FAIL_SIG)
-    return FAULT_ERROR;
+  it.it_value.tv_sec = timeout / 1000000;
+  it.it_value.tv_usec = timeout % 1000000;
 
-  /* It makes sense to account for the slowest units only if the testcase was run
-  under the user defined timeout. */
-  if (!(timeout > exec_tmout) && (slowest_exec_ms < exec_ms))
-  {
-    slowest_exec_ms = exec_ms;
-  }
+  setitimer(ITIMER_REAL, &it, NULL);
 
-  return FAULT_NONE;
+  if (waitpid(child_pid, &status, 0) <= 0)
+    PFATAL("waitpid() failed");
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  return finish_target(status, timeout);
 }
 
-/* Write modified data to file for testing. If out_file is set, the old file
+/* Write data to the file the target reads. If out_file is set, the old file
    is unlinked and a new one is created. Otherwise, out_fd is rewound and
    truncated. */
 
-static void write_to_testcase(void *mem, u32 len)
+static void write_testcase_file(void *mem, u32 len)
 {
 
   s32 fd = out_fd;
 
-  if (out_file)
+  /* The memfd is simply rewritten in place. The target opens it through
+     /proc, so it gets its own file offset. */
+
+  if (memfd_input)
+  {
+
+    if (pwrite(fd, mem, len, 0) != len)
+      PFATAL("Short write to '%s'", out_file);
+
+    if (ftruncate(fd, len))
+      PFATAL("ftruncate() failed");
+
+    return;
+  }
+
+  if (out_file)
   {
 
     unlink(out_file); /* Ignore errors. */
@@ -2950,6 +4328,34 @@ static void write_to_testcase(void *mem, u32 len)
     close(fd);
 }
 
+/* Write modified data for testing. When the target takes its testcases from
+   shm_fuzz, this is just a copy; otherwise, it goes to the file. */
+
+static void write_to_testcase(void *mem, u32 len)
+{
+
+  PROF_SCOPE(PROF_WRITE_TC);
+
+  if (execs)
+  {
+    execs[cur_exec].tc_mem = mem;
+    execs[cur_exec].tc_len = len;
+  }
+
+  if (use_shm_fuzz)
+  {
+
+    if (len > MAX_FILE)
+      len = MAX_FILE;
+
+    memcpy(shm_fuzz + sizeof(u32), mem, len);
+    *(u32 *)shm_fuzz = len;
+    return;
+  }
+
+  write_testcase_file(mem, len);
+}
+
 /* The same, but with an adjustable gap. Used for trimming. */
 
 static void write_with_gap(void *mem, u32 len, u32 skip_at, u32 skip_len)
@@ -2958,6 +4364,36 @@ static void write_with_gap(void *mem, u32 len, u32 skip_at, u32 skip_len)
   s32 fd = out_fd;
   u32 tail_len = len - skip_at - skip_len;
 
+  if (use_shm_fuzz)
+  {
+
+    if (skip_at)
+      memcpy(shm_fuzz + sizeof(u32), mem, skip_at);
+
+    if (tail_len)
+      memcpy(shm_fuzz + sizeof(u32) + skip_at, mem + skip_at + skip_len,
+             tail_len);
+
+    *(u32 *)shm_fuzz = len - skip_len;
+    return;
+  }
+
+  if (memfd_input)
+  {
+
+    if (skip_at && pwrite(fd, mem, skip_at, 0) != skip_at)
+      PFATAL("Short write to '%s'", out_file);
+
+    if (tail_len &&
+        pwrite(fd, mem + skip_at + skip_len, tail_len, skip_at) != tail_len)
+      PFATAL("Short write to '%s'", out_file);
+
+    if (ftruncate(fd, len - skip_len))
+      PFATAL("ftruncate() failed");
+
+    return;
+  }
+
   if (out_file)
   {
 
@@ -2990,216 +4426,1641 @@ static void write_with_gap(void *mem, u32 len, u32 skip_at, u32 skip_len)
 
 static void show_stats(void);
 
-static void modify_target(char **argv, u32 timeout_m)
+/* Growable open-addressing set of marker sites, used by the navigator to
+   track the sites seen during a checker run. A site is keyed by its object
+   index (upper 32 bits) and file offset (lower 32 bits); offsets are never
+   zero (a marker is always well past the ELF header), so zero marks an empty
+   slot. Keys are also kept in insertion order, which lets us walk the set and
+   clear it without touching every slot. */
+
+#define NAV_SITE(_obj, _off) (((u64)(_obj) << 32) | (_off))
+#define NAV_SITE_OBJ(_site) ((u32)((_site) >> 32))
+#define NAV_SITE_OFF(_site) ((u32)(_site))
+
+struct nav_set
+{
+  u64 *slots; /* Hash slots, 0 = empty            */
+  u64 *keys;  /* Keys in insertion order          */
+  u32 count;  /* Number of keys                   */
+  u32 size;   /* Slot count (power of two)        */
+};
+
+static void nav_set_init(struct nav_set *s)
+{
+
+  s->size = NAV_SET_INIT;
+  s->count = 0;
+  s->slots = ck_alloc(s->size * sizeof(u64));
+  s->keys = ck_alloc(s->size / 2 * sizeof(u64));
+}
+
+static void nav_set_free(struct nav_set *s)
+{
+
+  ck_free(s->slots);
+  ck_free(s->keys);
+  s->slots = s->keys = NULL;
+  s->count = s->size = 0;
+}
+
+/* Find the slot holding key, or the empty slot where it would go. */
+
+static inline u32 nav_set_slot(struct nav_set *s, u64 key)
+{
+
+  u32 h = key ^ (key >> 32);
+
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+
+  h &= s->size - 1;
+
+  while (s->slots[h] && s->slots[h] != key)
+    h = (h + 1) & (s->size - 1);
+
+  return h;
+}
+
+static void nav_set_grow(struct nav_set *s)
+{
+
+  u32 i;
+
+  ck_free(s->slots);
+
+  s->size <<= 1;
+  s->slots = ck_alloc(s->size * sizeof(u64));
+  s->keys = ck_realloc(s->keys, s->size / 2 * sizeof(u64));
+
+  for (i = 0; i < s->count; i++)
+    s->slots[nav_set_slot(s, s->keys[i])] = s->keys[i];
+}
+
+/* Add key to the set. Returns 1 if it was not there yet. */
+
+static u8 nav_set_add(struct nav_set *s, u64 key)
+{
+
+  u32 h = nav_set_slot(s, key);
+
+  if (s->slots[h])
+    return 0;
+
+  s->slots[h] = key;
+  s->keys[s->count++] = key;
+
+  if (s->count * 2 >= s->size)
+    nav_set_grow(s);
+
+  return 1;
+}
+
+/* Empty the set. Keys are removed in reverse insertion order, which undoes
+   the linear probing step by step and keeps every remaining chain intact. */
+
+static void nav_set_clear(struct nav_set *s)
+{
+
+  while (s->count)
+  {
+    s->count--;
+    s->slots[nav_set_slot(s, s->keys[s->count])] = 0;
+  }
+}
+
+/* Cut the " (deleted)" that /proc/<pid>/maps appends to the path of a file
+   that was replaced while mapped. With nav_live, that's how processes still
+   running off an older copy of a binary show it. */
+
+static void nav_strip_deleted(u8 *path)
+{
+
+  u32 len = strlen((char *)path), dlen = strlen(" (deleted)");
+
+  if (len > dlen && !strcmp((char *)path + len - dlen, " (deleted)"))
+    path[len - dlen] = 0;
+}
+
+/* Read the executable mappings of the patchable objects from the maps file
+   of a checker process. */
+
+static void nav_load_ranges(s32 pid)
+{
+
+  u8 *fn = alloc_printf("/proc/%d/maps", pid);
+  u8 line[MAX_LINE];
+  FILE *f;
+
+  nav_range_cnt = 0;
+
+  f = fopen((char *)fn, "r");
+  ck_free(fn);
+
+  if (!f)
+    return;
+
+  while (fgets((char *)line, sizeof(line), f))
+  {
+
+    u64 start, end, off, ino;
+    u8 perms[8], *path;
+    u32 i;
+    int pos = 0;
+
+    if (sscanf((char *)line, "%llx-%llx %7s %llx %*s %llu %n", &start, &end,
+               perms, &off, &ino, &pos) < 5 ||
+        !pos || perms[2] != 'x')
+      continue;
+
+    path = line + pos;
+    path[strcspn((char *)path, "\n")] = 0;
+    nav_strip_deleted(path);
+
+    for (i = 0; i < nav_obj_cnt; i++)
+    {
+
+      if (strcmp((char *)path, (char *)nav_objs[i].maps_path))
+        continue;
+
+      nav_ranges = ck_realloc(nav_ranges, (nav_range_cnt + 1) *
+                                              sizeof(struct nav_range));
+
+      nav_ranges[nav_range_cnt].start = start;
+      nav_ranges[nav_range_cnt].end = end;
+      nav_ranges[nav_range_cnt].off = off;
+      nav_ranges[nav_range_cnt].obj = i;
+      nav_range_cnt++;
+      break;
+    }
+  }
+
+  fclose(f);
+}
+
+/* Map a trap address in a checker process to a marker site. The cached
+   mappings are refreshed on a miss, which covers libraries loaded after the
+   cache was filled. Returns 0 for addresses outside the patchable objects. */
+
+static u64 nav_resolve(s32 pid, u64 addr)
+{
+
+  u32 i, retry;
+
+  for (retry = 0; retry < 2; retry++)
+  {
+
+    for (i = 0; i < nav_range_cnt; i++)
+    {
+
+      struct nav_range *r = &nav_ranges[i];
+
+      if (addr >= r->start && addr < r->end)
+        return NAV_SITE(r->obj, addr - r->start + r->off);
+    }
+
+    if (!retry)
+      nav_load_ranges(pid);
+  }
+
+  return 0;
+}
+
+/* Shut down the checker forkserver, if any. It has to go before the checker
+   binary can be patched, and gets restarted on the next navigation. */
+
+static void stop_nav_forkserver(void)
+{
+
+  int status;
+
+  if (nav_fsrv_pid <= 0)
+    return;
+
+  kill(nav_fsrv_pid, SIGKILL);
+  waitpid(nav_fsrv_pid, &status, 0);
+
+  close(nav_ctl_fd);
+  close(nav_st_fd);
+
+  nav_fsrv_pid = 0;
+  nav_ctl_fd = nav_st_fd = -1;
+
+  /* The next forkserver gets a fresh address space layout. */
+
+  nav_range_cnt = 0;
+}
+
+/* Spin up a forkserver for the checker binary, so that every navigation
+   starts from a loaded, relocated and initialized process. The runtime only
+   answers with NAV_FORKSRV_HELLO if it knows how to hold a fresh child until
+   we have attached to it; anything else (an older runtime, a checker that
+   dies during startup) makes us fall back to one execv() per navigation. */
+
+static void init_nav_forkserver(void)
+{
+
+  int st_pipe[2], ctl_pipe[2];
+  u32 hello = 0;
+  s32 rlen;
+
+  if (pipe(st_pipe) || pipe(ctl_pipe))
+    PFATAL("pipe() failed");
+
+  nav_fsrv_pid = fork();
+
+  if (nav_fsrv_pid < 0)
+    PFATAL("fork() failed");
+
+  if (!nav_fsrv_pid)
+  {
+
+    struct rlimit r;
+
+    r.rlim_max = r.rlim_cur = 0;
+
+    setrlimit(RLIMIT_CORE, &r); /* Ignore errors */
+
+    setsid();
+
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (out_file)
+    {
+      dup2(dev_null_fd, 0);
+    }
+    else
+    {
+      dup2(out_fd, 0);
+      close(out_fd);
+    }
+
+    if (dup2(ctl_pipe[0], FORKSRV_FD) < 0)
+      PFATAL("dup2() failed");
+    if (dup2(st_pipe[1], FORKSRV_FD + 1) < 0)
+      PFATAL("dup2() failed");
+
+    close(ctl_pipe[0]);
+    close(ctl_pipe[1]);
+    close(st_pipe[0]);
+    close(st_pipe[1]);
+
+    close(out_dir_fd);
+    close(dev_null_fd);
+    close(dev_urandom_fd);
+    close(fileno(plot_file));
+
+    /* The navigator only ever needs one iteration per child. */
+
+    unsetenv(PERSIST_ENV_VAR);
+    setenv(NAV_FORKSRV_ENV_VAR, "1", 1);
+
+    if (nav_checker_libs)
+      setenv("LD_LIBRARY_PATH", (char *)nav_checker_libs, 1);
+
+    if (!getenv("LD_BIND_LAZY"))
+      setenv("LD_BIND_NOW", "1", 0);
+
+    execv(checker_path, checker_argv);
+    exit(0);
+  }
+
+  close(ctl_pipe[0]);
+  close(st_pipe[1]);
+
+  nav_ctl_fd = ctl_pipe[1];
+  nav_st_fd = st_pipe[0];
+
+  fcntl(nav_ctl_fd, F_SETFD, FD_CLOEXEC);
+  fcntl(nav_st_fd, F_SETFD, FD_CLOEXEC);
+
+  /* Same deal as in init_forkserver(): don't wait forever. */
+
+  if (!wait_readable(nav_st_fd, exec_tmout_us * FORK_WAIT_MULT))
+    kill(nav_fsrv_pid, SIGKILL);
+
+  rlen = read(nav_st_fd, &hello, 4);
+
+  if (rlen == 4 && hello == NAV_FORKSRV_HELLO)
+    return;
+
+  WARNF("Checker forkserver not available, using execv() for navigation.");
+
+  stop_nav_forkserver();
+  nav_no_forksrv = 1;
+}
+
+/* Get a fresh child from the checker forkserver. The runtime keeps the
+   child blocked on the control pipe until we have attached to it with
+   PTRACE_SEIZE and sent a second command word; otherwise, the first marker
+   it runs into would kill it with SIGTRAP. Returns the child PID, or -1 if
+   this didn't work out, in which case we fall back to execv() for good. */
+
+static s32 fork_nav_child(void)
 {
 
-  // u32 modify_time_s = get_cur_time();
-  stop_forkserver();
+  u32 cmd = 0;
+  s32 pid;
+  int status;
 
-  memset(trace_bits, 0, MAP_SIZE);
+  if (write(nav_ctl_fd, &cmd, 4) != 4 || read(nav_st_fd, &pid, 4) != 4 ||
+      pid <= 0)
+    goto nav_fsrv_failed;
 
-  int fd_director = open(director_path, O_RDONLY);
-  long director_size = lseek((fd_director), 0, SEEK_END);
-  void *director_data = mmap(NULL, director_size, PROT_READ, MAP_SHARED, fd_director, 0);
-  if (director_data == MAP_FAILED)
+  if (ptrace(PTRACE_SEIZE, pid, NULL, (void *)PTRACE_O_EXITKILL))
   {
-    close(fd_director);
-    FATAL("when modify indirect call:mmap error\n");
+
+    /* Most likely ptrace_scope getting in the way. The child must not run
+       untraced, so get rid of it and collect its status. */
+
+    kill(pid, SIGKILL);
+    if (read(nav_st_fd, &status, 4) != 4)
+      PFATAL("Unable to communicate with checker forkserver");
+
+    goto nav_fsrv_failed;
   }
-  unsigned char *w = (unsigned char *)((char *)director_data);
 
-  pid_t pid;
-  pid = fork();
-  if (pid < 0)
+  if (write(nav_ctl_fd, &cmd, 4) != 4)
+    PFATAL("Unable to release checker child");
+
+  return pid;
+
+nav_fsrv_failed:
+
+  WARNF("Checker forkserver failed, using execv() for navigation.");
+
+  stop_nav_forkserver();
+  nav_no_forksrv = 1;
+
+  return -1;
+}
+
+/* Kinds of navigator stops, as told by classify_nav_site(). */
+
+enum
+{
+  /* 00 */ NAV_MARK_NONE,
+  /* 01 */ NAV_MARK_OUTSIDE,
+  /* 02 */ NAV_MARK_REGION
+};
+
+/* Tell what the navigator stopped at. Sites already moved into the region
+   count as NAV_MARK_NONE, as does anything that isn't a marker. The marker
+   table is authoritative when we have one; otherwise, look at the bytes in
+   the director: eb 00 90 90 is a non-region marker, eb 00 90 xx a region
+   one, and extended sites read 90 eb 00 90. */
+
+static u8 classify_nav_site(u64 site)
+{
+
+  struct nav_object *o;
+  struct nav_site *ns;
+  u32 loc;
+
+  if (!site)
+    return NAV_MARK_NONE;
+
+  o = &nav_objs[NAV_SITE_OBJ(site)];
+  loc = NAV_SITE_OFF(site);
+
+  if (o->site_cnt)
+  {
+
+    ns = find_nav_site(o, loc - 1);
+
+    if (!ns || (ns->flags & NAV_SITE_EXTENDED))
+      return NAV_MARK_NONE;
+
+    return (ns->flags & PDGF_SITE_REGION) ? NAV_MARK_REGION : NAV_MARK_OUTSIDE;
+  }
+
+  if (loc < 1 || loc + 2 >= o->w_size || o->w[loc - 1] != 0xeb ||
+      o->w[loc] != 0x00 || o->w[loc + 1] != 0x90)
+    return NAV_MARK_NONE;
+
+  return o->w[loc + 2] == 0x90 ? NAV_MARK_OUTSIDE : NAV_MARK_REGION;
+}
+
+/* Run the checker on the current test case under ptrace and collect the
+   non-region marker sites that were executed right before a region marker.
+   These blocks lead into the region but were missed by the static analysis.
+   The session is bounded by nav_stop_budget traps, nav_patch_budget sites
+   and nav_tmout milliseconds of wall-clock time; hitting any of these limits
+   counts the session as truncated. */
+
+static void run_navigator(u32 timeout_m, struct nav_set *sites)
+{
+
+  static struct itimerval it;
+  struct user_regs_struct regs;
+  struct nav_set trace;
+  u32 stops = 0, tmout, i;
+  u8 alive = 1, cut = 0, exec_trap = 0, from_fsrv = 0;
+  int status;
+  s32 pid = -1;
+
+  tmout = nav_tmout ? nav_tmout : timeout_m * NAV_TMOUT_MULT;
+
+  /* In stdin mode, the checker shares out_fd with the director runs. */
+
+  if (!out_file)
+    lseek(out_fd, 0, SEEK_SET);
+
+  if (!nav_no_forksrv && !nav_fsrv_pid)
+    init_nav_forkserver();
+
+  if (nav_fsrv_pid)
+    pid = fork_nav_child();
+
+  if (pid > 0)
+  {
+    from_fsrv = 1;
+  }
+  else
+  {
+
+    /* A checker started from scratch can't attach to shm_fuzz, so it needs
+       the testcase in the file. */
+
+    if (use_shm_fuzz)
+      write_testcase_file(shm_fuzz + sizeof(u32), *(u32 *)shm_fuzz);
+
+    pid = fork();
+    exec_trap = 1;
+    nav_range_cnt = 0;
+  }
+
+  if (pid < 0)
+    PFATAL("fork() failed");
+
+  if (!pid)
+  {
+
+    /* Feed the checker the same input as the director. */
+
+    if (out_file)
+    {
+      dup2(dev_null_fd, 0);
+    }
+    else
+    {
+      dup2(out_fd, 0);
+      close(out_fd);
+    }
+
+    dup2(dev_null_fd, 1);
+    dup2(dev_null_fd, 2);
+
+    if (nav_checker_libs)
+      setenv("LD_LIBRARY_PATH", (char *)nav_checker_libs, 1);
+
+    /* One iteration, as with the checker forkserver. */
+
+    unsetenv(PERSIST_ENV_VAR);
+
+    ptrace(PTRACE_TRACEME, 0, 0, 0);
+
+    execv(checker_path, checker_argv);
+    exit(0);
+  }
+
+  nav_sessions++;
+  nav_set_init(&trace);
+
+  /* Let handle_timeout() take care of a runaway checker. */
+
+  child_pid = pid;
+  child_timed_out = 0;
+
+  it.it_value.tv_sec = (tmout / 1000);
+  it.it_value.tv_usec = (tmout % 1000) * 1000;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  while (1)
+  {
+
+    if (waitpid(pid, &status, 0) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      PFATAL("waitpid() failed");
+    }
+
+    if (!WIFSTOPPED(status))
+    {
+      alive = 0;
+      break;
+    }
+
+    if (WSTOPSIG(status) != SIGTRAP || stop_soon)
+      break;
+
+    /* With a fresh execv(), the first trap comes from the exec itself. */
+
+    if (exec_trap)
+    {
+      exec_trap = 0;
+    }
+    else
+    {
+
+      u64 site;
+      u8 kind;
+
+      stops++;
+
+      ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+
+      /* The trap leaves rip right past the marker's first byte. */
+
+      site = nav_resolve(pid, regs.rip);
+      kind = classify_nav_site(site);
+
+      if (kind != NAV_MARK_NONE)
+      {
+
+        if (kind == NAV_MARK_OUTSIDE)
+        {
+
+          /* Non-region marker: remember it until we see where it leads. */
+
+          if (stops > nav_stop_budget)
+          {
+            cut = 1;
+            break;
+          }
+
+          nav_set_add(&trace, site);
+        }
+        else
+        {
+
+          /* Region marker: everything traced since the last one reaches
+             the region, so it becomes a patch site. */
+
+          for (i = 0; i < trace.count; i++)
+          {
+
+            if (sites->count >= nav_patch_budget)
+            {
+              cut = 1;
+              break;
+            }
+
+            nav_set_add(sites, trace.keys[i]);
+          }
+
+          if (cut)
+            break;
+
+          nav_set_clear(&trace);
+        }
+      }
+    }
+
+    ptrace(PTRACE_CONT, pid, NULL, NULL);
+  }
+
+  if (alive)
+  {
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+  }
+
+  /* The forkserver reports the child's fate, too. */
+
+  if (from_fsrv && read(nav_st_fd, &status, 4) != 4)
+  {
+    WARNF("Lost the checker forkserver, will restart it.");
+    stop_nav_forkserver();
+  }
+
+  it.it_value.tv_sec = 0;
+  it.it_value.tv_usec = 0;
+
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  if (child_timed_out)
+  {
+    nav_timeouts++;
+    cut = 1;
+  }
+
+  if (cut)
+    nav_truncated++;
+
+  child_pid = -1;
+  child_timed_out = 0;
+
+  nav_set_free(&trace);
+}
+
+/* Write 'len' bytes at file offset 'off' of a checker or director copy,
+   remembering the write for poke_nav_processes() when nav_live is set. */
+
+static void nav_write(FILE *f, u8 dir, u32 obj, u32 off, void *data, u32 len)
+{
+
+  struct nav_poke *p;
+
+  fseek(f, off, SEEK_SET);
+  fwrite(data, len, 1, f);
+
+  if (!nav_live)
+    return;
+
+  nav_pokes = ck_realloc(nav_pokes, (nav_poke_cnt + 1) * sizeof(struct nav_poke));
+  p = &nav_pokes[nav_poke_cnt++];
+
+  p->obj = obj;
+  p->off = off;
+  p->dir = dir;
+  p->len = len;
+  memcpy(p->data, data, len);
+}
+
+/* Turn a non-region marker site into a region one. In the director, the
+   marker becomes 90 eb 00 90; in both binaries, the block ID is moved from
+   the non-region slice into the region slice. The ID is located by looking
+   for the xor immediate that follows the marker, and then for the store of
+   cur_loc >> 1 into prev_loc. What gets overwritten is saved in 'e'. */
+
+static void patch_region_site(FILE *checker_file, FILE *director_file,
+                              struct nav_object *o, u32 offset,
+                              struct nav_ext *e)
+{
+
+  static u8 mdf_char[3] = {0x90, 0xeb, 0x00};
+
+  u32 old_loc = 0, new_loc = 0, imm, ii, w_size = o->w_size, oi = o - nav_objs;
+  u8 *w = o->w, bb_id[2];
+  struct nav_site *ns = o->site_cnt ? find_nav_site(o, offset - 1) : NULL;
+
+  nav_write(director_file, 1, oi, offset - 1, mdf_char, sizeof(mdf_char));
+
+  if (ns)
+  {
+
+    /* We know the exact ID, so just look for the two immediates. */
+
+    u32 new_loc = ns->cur_loc - 3 * (map_size >> 2),
+        ids[2] = {ns->cur_loc, ns->cur_loc >> 1},
+        new_ids[2] = {new_loc, new_loc >> 1};
+    u8 done[2] = {0, 0};
+
+    for (ii = 0; ii < NAV_ID_WINDOW && offset + ii + 4 <= w_size; ii++)
+    {
+
+      u32 k;
+
+      for (k = 0; k < 2; k++)
+      {
+
+        if (done[k] || memcmp(w + offset + ii, &ids[k], 4))
+          continue;
+
+        e->id_off[k] = offset + ii;
+        e->id_len[k] = 4;
+        memcpy(e->id_orig[k], w + offset + ii, 4);
+
+        nav_write(checker_file, 0, oi, offset + ii, &new_ids[k], 4);
+        nav_write(director_file, 1, oi, offset + ii, &new_ids[k], 4);
+
+        done[k] = 1;
+      }
+
+      if (done[0] && done[1])
+        break;
+    }
+
+    e->loc = new_ids[0];
+
+    ns->flags |= NAV_SITE_EXTENDED;
+    return;
+  }
+
+  for (ii = 0; ii < NAV_ID_WINDOW && offset + ii + 4 < w_size; ii++)
+  {
+
+    if (!old_loc)
+    {
+
+      if (w[offset + ii] == 0x48 && w[offset + ii + 1] == 0x35)
+        imm = offset + ii + 2;
+      else if (w[offset + ii] == 0x48 && w[offset + ii + 1] == 0x81)
+        imm = offset + ii + 3;
+      else
+        continue;
+
+      old_loc = w[imm] | (w[imm + 1] << 8);
+      new_loc = old_loc - 3 * (map_size >> 2);
+
+      e->loc = new_loc;
+      e->id_off[0] = imm;
+      e->id_len[0] = 2;
+      memcpy(e->id_orig[0], w + imm, 2);
+
+      bb_id[0] = new_loc;
+      bb_id[1] = new_loc >> 8;
+
+      nav_write(checker_file, 0, oi, imm, bb_id, sizeof(bb_id));
+      nav_write(director_file, 1, oi, imm, bb_id, sizeof(bb_id));
+    }
+    else if (w[offset + ii] == ((old_loc >> 1) & 0xff) &&
+             w[offset + ii + 1] == ((old_loc >> 9) & 0xff))
+    {
+
+      bb_id[0] = new_loc >> 1;
+      bb_id[1] = new_loc >> 9;
+
+      e->id_off[1] = offset + ii;
+      e->id_len[1] = 2;
+      memcpy(e->id_orig[1], w + offset + ii, 2);
+
+      nav_write(checker_file, 0, oi, offset + ii, bb_id, sizeof(bb_id));
+      nav_write(director_file, 1, oi, offset + ii, bb_id, sizeof(bb_id));
+      break;
+    }
+  }
+}
+
+/* Map the director image of every object, so that we can look at the bytes
+   around a marker while the files are being patched. */
+
+static void map_nav_object(struct nav_object *o)
+{
+
+  s32 fd = open(o->director_path, O_RDONLY);
+
+  if (fd < 0)
+    PFATAL("Unable to open '%s'", o->director_path);
+
+  o->w_size = lseek(fd, 0, SEEK_END);
+  o->w = mmap(NULL, o->w_size, PROT_READ, MAP_SHARED, fd, 0);
+
+  if (o->w == MAP_FAILED)
+    PFATAL("mmap() failed on '%s'", o->director_path);
+
+  close(fd);
+}
+
+static void map_nav_objects(void)
+{
+
+  u32 i;
+
+  for (i = 0; i < nav_obj_cnt; i++)
+    map_nav_object(&nav_objs[i]);
+}
+
+static void unmap_nav_objects(void)
+{
+
+  u32 i;
+
+  for (i = 0; i < nav_obj_cnt; i++)
+  {
+    munmap(nav_objs[i].w, nav_objs[i].w_size);
+    nav_objs[i].w = NULL;
+  }
+}
+
+/* Give an object fresh checker and director files before patching them
+   under running processes, which keep the old ones (writing to a file that
+   is being executed fails with ETXTBSY anyway). The image mapping follows
+   the director to its new file. */
+
+static void unshare_nav_object(struct nav_object *o)
+{
+
+  u8 *tmp, mapped = !!o->w;
+
+  if (mapped)
+    munmap(o->w, o->w_size);
+
+  tmp = alloc_printf("%s.new", o->checker_path);
+  copy_binary((char *)o->checker_path, (char *)tmp);
+  if (rename(tmp, o->checker_path))
+    PFATAL("Unable to rename '%s'", tmp);
+  ck_free(tmp);
+
+  tmp = alloc_printf("%s.new", o->director_path);
+  copy_binary((char *)o->director_path, (char *)tmp);
+  if (rename(tmp, o->director_path))
+    PFATAL("Unable to rename '%s'", tmp);
+  ck_free(tmp);
+
+  if (mapped)
+    map_nav_object(o);
+}
+
+/* Repeat the pending writes in the memory of a process running off the
+   checker (dir = 0) or director (dir = 1) copies. Objects the process has
+   not mapped yet are skipped; it will load the patched files. Returns 0 if
+   the process could not be patched. */
+
+static u8 poke_nav_process(s32 pid, u8 dir)
+{
+
+  u8 *fn, line[MAX_LINE];
+  FILE *f;
+  s32 fd;
+  u32 i;
+  u8 ok = 1;
+
+  fn = alloc_printf("/proc/%d/maps", pid);
+  f = fopen((char *)fn, "r");
+  ck_free(fn);
+
+  if (!f)
+    return 0;
+
+  fn = alloc_printf("/proc/%d/mem", pid);
+  fd = open((char *)fn, O_RDWR);
+  ck_free(fn);
+
+  if (fd < 0)
+  {
+    fclose(f);
+    return 0;
+  }
+
+  while (ok && fgets((char *)line, sizeof(line), f))
+  {
+
+    u64 start, end, off, ino;
+    u8 perms[8], *path;
+    u32 obj;
+    int pos = 0;
+
+    if (sscanf((char *)line, "%llx-%llx %7s %llx %*s %llu %n", &start, &end,
+               perms, &off, &ino, &pos) < 5 ||
+        !pos || perms[2] != 'x')
+      continue;
+
+    path = line + pos;
+    path[strcspn((char *)path, "\n")] = 0;
+    nav_strip_deleted(path);
+
+    for (obj = 0; obj < nav_obj_cnt; obj++)
+      if (!strcmp((char *)path, (char *)(dir ? nav_objs[obj].dir_maps_path
+                                             : nav_objs[obj].maps_path)))
+        break;
+
+    if (obj == nav_obj_cnt)
+      continue;
+
+    for (i = 0; i < nav_poke_cnt; i++)
+    {
+
+      struct nav_poke *p = &nav_pokes[i];
+
+      if (p->dir != dir || p->obj != obj || p->off < off ||
+          p->off + p->len > off + (end - start))
+        continue;
+
+      if (pwrite(fd, p->data, p->len, start + p->off - off) != p->len)
+      {
+        ok = 0;
+        break;
+      }
+    }
+  }
+
+  close(fd);
+  fclose(f);
+
+  return ok;
+}
+
+/* Bring the running processes up to date after patching. Without nav_live,
+   the forkserver was stopped for the patch and gets restarted here. With
+   it, the writes go straight into the director forkserver, its stopped
+   persistent child and the checker forkserver. Should the director refuse,
+   we go back to restarting it. With -j, only the selected executor is
+   restarted here; every running one is patched. */
+
+static void resume_nav_processes(char **argv)
+{
+
+  u32 i, me = cur_exec;
+  u8 ok = 1;
+
+  if (!nav_live)
+  {
+    init_forkserver(argv);
+    return;
+  }
+
+  if (!nav_poke_cnt)
+    return;
+
+  if (nav_fsrv_pid > 0 && !poke_nav_process(nav_fsrv_pid, 0))
+    stop_nav_forkserver();
+
+  /* A run still in flight would stop unpatched in persistent mode. */
+
+  drain_executors();
+
+  for (i = 0; ok && i < exec_cnt; i++)
+  {
+
+    select_executor(i);
+
+    if (forksrv_pid > 0 &&
+        (!poke_nav_process(forksrv_pid, 1) ||
+         (persist_pid > 0 && !poke_nav_process(persist_pid, 1))))
+      ok = 0;
+  }
+
+  select_executor(me);
+
+  if (!ok)
+  {
+
+    WARNF("Unable to patch the running director, restarting it instead.");
+
+    nav_live = 0;
+
+    stop_executors();
+    stop_nav_forkserver();
+    init_forkserver(argv);
+  }
+
+  nav_poke_cnt = 0;
+}
+
+/* Check that the marker at file offset 'off' is a non-region one that has
+   not been extended yet. Sites read from a region log come from another
+   session, so we don't take them on trust. */
+
+static u8 nav_site_extendable(struct nav_object *o, u32 off)
+{
+
+  struct nav_site *ns;
+
+  if (o->site_cnt)
+  {
+    ns = find_nav_site(o, off);
+    return ns && !(ns->flags & (PDGF_SITE_REGION | NAV_SITE_EXTENDED |
+                                NAV_SITE_RETIRED));
+  }
+
+  return off + 4 <= o->w_size && o->w[off] == 0xeb && !o->w[off + 1] &&
+         o->w[off + 2] == 0x90 && o->w[off + 3] == 0x90;
+}
+
+/* Append a record to <out_dir>/region_log. Each record is a single line:
+   "<type> <object> <marker offset> <unix time>", where the type is E for an
+   extension and D for a retired one. */
+
+static void log_region_site(u8 type, struct nav_object *o, u32 off)
+{
+
+  u8 *line;
+
+  if (region_log_fd < 0)
+    return;
+
+  line = alloc_printf("%c %s 0x%x %llu\n", type, o->name, off,
+                      get_cur_time() / 1000);
+
+  ck_write(region_log_fd, line, strlen(line), "region_log");
+
+  ck_free(line);
+}
+
+/* Patch the given sites into the region and log them if asked to. Sites that
+   are no longer extendable are skipped. The objects must be mapped, and
+   unless nav_live is set, no forkserver may be running off the binaries.
+   Returns the number of sites patched. */
+
+static u32 extend_nav_sites(struct nav_set *sites, u8 log_them)
+{
+
+  FILE *checker_file, *director_file;
+  struct nav_ext *e;
+  u32 i, j, off, patched = 0;
+
+  for (i = 0; i < nav_obj_cnt; i++)
+  {
+
+    struct nav_object *o = &nav_objs[i];
+
+    checker_file = NULL;
+    director_file = NULL;
+
+    for (j = 0; j < sites->count; j++)
+    {
+
+      if (NAV_SITE_OBJ(sites->keys[j]) != i)
+        continue;
+
+      off = NAV_SITE_OFF(sites->keys[j]);
+
+      if (!nav_site_extendable(o, off - 1))
+        continue;
+
+      if (!checker_file)
+      {
+
+        if (nav_live)
+          unshare_nav_object(o);
+
+        checker_file = fopen(o->checker_path, "rb+");
+        if (!checker_file)
+          PFATAL("Unable to open '%s'", o->checker_path);
+
+        director_file = fopen(o->director_path, "rb+");
+        if (!director_file)
+          PFATAL("Unable to open '%s'", o->director_path);
+      }
+
+      nav_exts = ck_realloc(nav_exts, (nav_ext_cnt + 1) * sizeof(struct nav_ext));
+      e = &nav_exts[nav_ext_cnt++];
+
+      memset(e, 0, sizeof(struct nav_ext));
+      e->obj = i;
+      e->off = off - 1;
+      e->born = total_execs;
+
+      patch_region_site(checker_file, director_file, o, off, e);
+
+      /* The fallback path goes by the director bytes, so they need to be
+         visible through our mapping before the next site is looked at. */
+
+      fflush(director_file);
+
+      if (log_them)
+        log_region_site('E', o, off - 1);
+
+      patched++;
+    }
+
+    if (checker_file)
+    {
+      fclose(director_file);
+      fclose(checker_file);
+    }
+  }
+
+  if (patched)
+    nav_locs_stale = 1;
+
+  return patched;
+}
+
+/* Rebuild the set of block IDs in the region slice: the region blocks of the
+   marker tables, plus the live extensions. */
+
+static void build_region_locs(void)
+{
+
+  struct nav_site *ns;
+  u32 i, j;
+
+  memset(nav_region_loc, 0, sizeof(nav_region_loc));
+  memset(nav_region_prev, 0, sizeof(nav_region_prev));
+
+  for (i = 0; i < nav_obj_cnt; i++)
+    for (j = 0; j < nav_objs[i].site_cnt; j++)
+    {
+      ns = &nav_objs[i].sites[j];
+      if ((ns->flags & PDGF_SITE_REGION) && ns->cur_loc < (map_size >> 2) &&
+          ns->prev_loc < (map_size >> 2))
+      {
+        nav_region_loc[ns->cur_loc] = 1;
+        nav_region_prev[ns->prev_loc] = 1;
+      }
+    }
+
+  for (i = 0; i < nav_ext_cnt; i++)
+    if (!nav_exts[i].dead && nav_exts[i].loc < (map_size >> 2))
+    {
+      nav_region_loc[nav_exts[i].loc] = 1;
+      nav_region_prev[nav_exts[i].loc >> 1] = 1;
+    }
+
+  nav_locs_stale = 0;
+}
+
+/* Tell whether a region slot can hold an edge into or out of the block with
+   ID 'loc', given the other region blocks. */
+
+static inline u8 nav_slot_touches(u32 slot, u32 loc)
+{
+
+  u32 p = slot ^ loc, c = slot ^ (loc >> 1);
+
+  if (p < (map_size >> 2) && nav_region_prev[p])
+    return 1;
+
+  return c < (map_size >> 2) && nav_region_loc[c];
+}
+
+/* Credit the find in trace_bits to every live extension it went through.
+   That's judged by the region slots it hit, so it's only a good guess when
+   every object has a marker table. */
+
+static void credit_nav_exts(u8 hnb)
+{
+
+  u32 *cur = (u32 *)trace_bits;
+  u32 i, j, k;
+
+  if (!nav_ext_cnt)
+    return;
+
+  if (nav_locs_stale)
+    build_region_locs();
+
+  for (i = 0; i < (map_size >> 4); i++)
+  {
+
+    if (!cur[i])
+      continue;
+
+    for (j = i << 2; j < (i << 2) + 4; j++)
+    {
+
+      if (!trace_bits[j])
+        continue;
+
+      for (k = 0; k < nav_ext_cnt; k++)
+        if (!nav_exts[k].dead && !nav_exts[k].hit &&
+            nav_slot_touches(j, nav_exts[k].loc))
+          nav_exts[k].hit = 1;
+    }
+  }
+
+  for (k = 0; k < nav_ext_cnt; k++)
+  {
+
+    if (!nav_exts[k].hit)
+      continue;
+
+    nav_exts[k].hit = 0;
+    nav_exts[k].finds++;
+
+    if (hnb >= 3)
+      nav_exts[k].region_finds++;
+  }
+}
+
+/* Undo an extension in both binaries and ban the site from being extended
+   again. top_rated[] is left alone: the slots the extension fed can't be
+   told apart from those of the live region blocks, and a stale favorite
+   only costs one extra favored entry. */
+
+static void retire_nav_ext(FILE *checker_file, FILE *director_file,
+                           struct nav_ext *e)
+{
+
+  static u8 marker[3] = {0xeb, 0x00, 0x90};
+
+  struct nav_site *ns = find_nav_site(&nav_objs[e->obj], e->off);
+  u32 k;
+
+  nav_write(director_file, 1, e->obj, e->off, marker, sizeof(marker));
+
+  for (k = 0; k < 2; k++)
+  {
+
+    if (!e->id_len[k])
+      continue;
+
+    nav_write(checker_file, 0, e->obj, e->id_off[k], e->id_orig[k],
+              e->id_len[k]);
+    nav_write(director_file, 1, e->obj, e->id_off[k], e->id_orig[k],
+              e->id_len[k]);
+  }
+
+  if (ns)
+    ns->flags = (ns->flags & ~NAV_SITE_EXTENDED) | NAV_SITE_RETIRED;
+
+  e->dead = 1;
+  nav_locs_stale = 1;
+
+  nav_sites_retired++;
+}
+
+/* Retire the live extensions at the given sites, logging them if asked to.
+   As with extend_nav_sites(), no forkserver may be running off the binaries
+   without nav_live. Returns the number of extensions retired. */
+
+static u32 retire_nav_sites(struct nav_set *sites, u8 log_them)
+{
+
+  FILE *checker_file, *director_file;
+  struct nav_ext *e;
+  u32 i, j, k, off, retired = 0;
+
+  for (i = 0; i < nav_obj_cnt; i++)
+  {
+
+    checker_file = NULL;
+    director_file = NULL;
+
+    for (j = 0; j < sites->count; j++)
+    {
+
+      if (NAV_SITE_OBJ(sites->keys[j]) != i)
+        continue;
+
+      off = NAV_SITE_OFF(sites->keys[j]) - 1;
+
+      for (k = 0; k < nav_ext_cnt; k++)
+        if (nav_exts[k].obj == i && nav_exts[k].off == off && !nav_exts[k].dead)
+          break;
+
+      if (k == nav_ext_cnt)
+        continue;
+
+      e = &nav_exts[k];
+
+      if (!checker_file)
+      {
+
+        if (nav_live)
+          unshare_nav_object(&nav_objs[i]);
+
+        checker_file = fopen(nav_objs[i].checker_path, "rb+");
+        if (!checker_file)
+          PFATAL("Unable to open '%s'", nav_objs[i].checker_path);
+
+        director_file = fopen(nav_objs[i].director_path, "rb+");
+        if (!director_file)
+          PFATAL("Unable to open '%s'", nav_objs[i].director_path);
+      }
+
+      retire_nav_ext(checker_file, director_file, e);
+
+      if (log_them)
+        log_region_site('D', &nav_objs[i], off);
+
+      retired++;
+    }
+
+    if (checker_file)
+    {
+      fclose(director_file);
+      fclose(checker_file);
+    }
+  }
+
+  return retired;
+}
+
+/* Region maintenance, done every NAV_MAINT_INTERVAL seconds: retire the
+   extensions that have had nav_ext_grace execs to prove themselves, but
+   never took part in a find that added region coverage. Finds can only be
+   attributed with a marker table for every object, so we do nothing
+   otherwise. */
+
+static void maintain_region(char **argv)
+{
+
+  static u64 last_maint;
+
+  struct nav_set retire;
+  u64 cur_ms = get_cur_time();
+  u32 i, n;
+
+  if (!nav_ext_grace || !nav_ext_cnt)
+    return;
+
+  if (!last_maint)
+    last_maint = cur_ms;
+
+  if (cur_ms - last_maint < NAV_MAINT_INTERVAL * 1000)
+    return;
+
+  last_maint = cur_ms;
+
+  for (i = 0; i < nav_obj_cnt; i++)
+    if (!nav_objs[i].site_cnt)
+      return;
+
+  nav_set_init(&retire);
+
+  for (i = 0; i < nav_ext_cnt; i++)
+  {
+
+    struct nav_ext *e = &nav_exts[i];
+
+    if (e->dead || e->region_finds || total_execs - e->born < nav_ext_grace)
+      continue;
+
+    nav_set_add(&retire, NAV_SITE(e->obj, e->off + 1));
+  }
+
+  if (retire.count)
+  {
+
+    if (!nav_live)
+    {
+      stop_executors();
+      stop_nav_forkserver();
+    }
+
+    n = retire_nav_sites(&retire, 1);
+
+    resume_nav_processes(argv);
+
+    if (not_on_tty)
+      ACTF("Retired %u region extension%s.", n, n == 1 ? "" : "s");
+  }
+
+  nav_set_free(&retire);
+}
+
+/* Extend the region with the blocks the navigator found on the path of the
+   current test case, then restart the forkserver on the patched director,
+   or with nav_live, patch the running one. */
+
+static void modify_target(char **argv, u32 timeout_m)
+{
+
+  struct nav_set sites;
+  u64 trace_ticks;
+  u32 me = cur_exec;
+
+  /* Everything but the navigator run itself is patch/restart time. */
+
+  PROF_SCOPE(PROF_NAV_PATCH);
+
+  if (!nav_live)
+    stop_executors();
+
+  /* The checker reads executor 0's input, so that's where the test case
+     that got us here has to go. */
+
+  if (me)
+  {
+    select_executor(0);
+    write_to_testcase(execs[me].tc_mem, execs[me].tc_len);
+  }
+
+  memset(trace_bits, 0, map_size + PDGF_MAX_TARGETS);
+
+  map_nav_objects();
+
+  nav_set_init(&sites);
+
+  trace_ticks = prof_clock();
+
+  run_navigator(timeout_m, &sites);
+
+  trace_ticks = prof_clock() - trace_ticks;
+  prof_ticks[PROF_NAV_TRACE] += trace_ticks;
+  prof_ticks[PROF_NAV_PATCH] -= trace_ticks;
+  prof_calls[PROF_NAV_TRACE]++;
+
+  if (sites.count)
+  {
+
+    /* A running checker keeps its binary busy (ETXTBSY). */
+
+    if (!nav_live)
+      stop_nav_forkserver();
+
+    nav_sites_patched += extend_nav_sites(&sites, 1);
+  }
+
+  unmap_nav_objects();
+
+  nav_set_free(&sites);
+
+  select_executor(me);
+
+  resume_nav_processes(argv);
+}
+
+/* Collect the extensions recorded in the region log at 'path', starting at
+   byte '*pos', that still apply to our binaries. Retirements are applied to
+   the marker tables right away, so that the sites can't be extended again;
+   the ones we have live extensions for are collected into 'retire'. Only
+   complete lines are consumed, since the owner may be in the middle of
+   appending one; '*pos' is moved past them. Records of unknown objects are
+   ignored. */
+
+static void read_region_log(u8 *path, u64 *pos, struct nav_set *sites,
+                            struct nav_set *retire)
+{
+
+  struct nav_site *ns;
+  FILE *f;
+  u8 line[512], name[256];
+  u32 len, off, i;
+
+  f = fopen((char *)path, "r");
+  if (!f)
+    return;
+
+  if (fseek(f, *pos, SEEK_SET))
+  {
+    fclose(f);
+    return;
+  }
+
+  while (fgets((char *)line, sizeof(line), f))
+  {
+
+    len = strlen((char *)line);
+
+    if (line[len - 1] != '\n')
+      break;
+
+    *pos += len;
+
+    if ((line[0] != 'E' && line[0] != 'D') ||
+        sscanf((char *)line + 1, " %255s %x", name, &off) != 2)
+      continue;
+
+    for (i = 0; i < nav_obj_cnt; i++)
+      if (!strcmp((char *)nav_objs[i].name, (char *)name))
+        break;
+
+    if (i == nav_obj_cnt)
+      continue;
+
+    if (line[0] == 'D')
+    {
+
+      ns = nav_objs[i].site_cnt ? find_nav_site(&nav_objs[i], off) : NULL;
+
+      if (!ns)
+        continue;
+
+      if (ns->flags & NAV_SITE_EXTENDED)
+        nav_set_add(retire, NAV_SITE(i, off + 1));
+
+      ns->flags |= NAV_SITE_RETIRED;
+      continue;
+    }
+
+    if (!nav_site_extendable(&nav_objs[i], off))
+      continue;
+
+    nav_set_add(sites, NAV_SITE(i, off + 1));
+  }
+
+  fclose(f);
+}
+
+/* Tell whether dir is the queue/ directory of an earlier session, that is,
+   it's called "queue" and has a fuzzer_stats file next to it. */
+
+static u8 is_session_queue(u8 *dir)
+{
+
+  u8 *fn;
+  u32 len = strlen(dir);
+  s32 ret;
+
+  while (len > 1 && dir[len - 1] == '/')
+    len--;
+
+  if (len < 5 || strncmp(dir + len - 5, "queue", 5) ||
+      (len > 5 && dir[len - 6] != '/'))
+    return 0;
+
+  fn = alloc_printf("%s/../fuzzer_stats", dir);
+  ret = access(fn, F_OK);
+  ck_free(fn);
+
+  return !ret;
+}
+
+/* Open the region log and replay the extensions of the session we are
+   picking up from: our own log when resuming in place, or the one next to
+   the queue we were pointed at. Replayed records are only logged again if
+   they came from elsewhere. */
+
+static void setup_region_log(void)
+{
+
+  struct nav_set sites, retire;
+  u8 *fn;
+  u64 pos = 0;
+  u32 n;
+
+  fn = alloc_printf("%s/region_log", out_dir);
+
+  region_log_fd = open(fn, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+  if (region_log_fd < 0)
+    PFATAL("Unable to create '%s'", fn);
+
+  ck_free(fn);
+
+  /* By now, pivot_inputs() has removed <out_dir>/_resume. Otherwise, the
+     log is only picked up if -i points at the queue of an earlier session,
+     lest a fresh run import whatever lies next to its seeds. */
+
+  if (in_place_resume)
+    fn = alloc_printf("%s/region_log", out_dir);
+  else if (resuming_fuzz && is_session_queue(in_dir))
+    fn = alloc_printf("%s/../region_log", in_dir);
+  else
+    return;
+
+  map_nav_objects();
+  nav_set_init(&sites);
+  nav_set_init(&retire);
+
+  read_region_log(fn, &pos, &sites, &retire);
+
+  if (sites.count)
   {
-    exit(EXIT_FAILURE);
-  }
 
-  if (pid == 0)
-  {
-    dup2(dev_null_fd, 1);
-    dup2(dev_null_fd, 2);
-    dup2(dev_null_fd, 0);
-    ptrace(PTRACE_TRACEME, 0, 0, 0);
+    n = extend_nav_sites(&sites, !in_place_resume);
+    nav_sites_patched += n;
 
-    execv(checker_path, checker_argv);
+    if (n)
+      OKF("Replayed %u region extension%s from '%s'.", n,
+          n == 1 ? "" : "s", fn);
   }
 
-  else
-  {
-    int status;
-    struct user_regs_struct regs;
-    int trace_index = 0;
-    int modify_index = 0;
-    int trace_location[900000];
-    int modify_locaion[30000];
-    int first = 0;
-    u64 start_time_m = get_cur_time();
-    int nnn = 1;
+  if (retire.count)
+    retire_nav_sites(&retire, !in_place_resume);
 
-    while (1)
-    {
-      if (pid == -1)
-        break;
-      waitpid(pid, &status, 0);
+  unmap_nav_objects();
+  nav_set_free(&sites);
+  nav_set_free(&retire);
 
-      if (WIFEXITED(status))
-        break;
-      if (WIFSTOPPED(status) && WSTOPSIG(status) == 5)
-      {
-        if (first++)
-        {
-          ptrace(PTRACE_GETREGS, pid, NULL, &regs); 
+  ck_free(fn);
+}
 
-          int locate_line = regs.rip - 0x400000;
+/* Import the region extensions a peer has logged since we last looked. The
+   read position is kept in <out_dir>/.synced/<peer>.region. */
 
-          if (w[locate_line - 1] == 0xeb && w[locate_line] == 0x00 && w[locate_line + 1] == 0x90 && w[locate_line + 2] == 0x90)
-          {
+static void sync_region_log(char **argv, u8 *peer)
+{
 
-            if (first > 30000)
-            {
-              ptrace(PTRACE_KILL, pid);
-              wait(pid);
-              break;
-            }
+  struct nav_set sites, retire;
+  struct stat st;
+  u8 *fn, *pos_fn;
+  u64 pos = 0;
+  s32 fd;
+  u32 n;
 
-            else
-            {
-              int exist_t = 0;
-              for (int i = 0; i < trace_index; i++)
-              {
-                if (trace_location[trace_index - i - 1] == locate_line)
-                {
-                  exist_t = 1;
-                  break;
-                }
-              }
-              if (!exist_t)
-              {
-                trace_location[trace_index] = locate_line;
-                trace_index++;
-              }
-            }
-          }
-          else if (w[locate_line - 1] == 0xeb && w[locate_line] == 0x00 && w[locate_line + 1] == 0x90 && w[locate_line + 2] != 0x90)
-          {
-            while (trace_index > 0)
-            {
-              int exist = 0;
-
-              for (int i = 0; i < modify_index; i++)
-              {
-                if (modify_locaion[i] == trace_location[trace_index - 1])
-                {
-                  exist = 1;
-                  break;
-                }
-              }
-              if (exist == 0)
-              {
-
-                if (trace_index < 1)
-                  FATAL("error");
-                modify_locaion[modify_index] = trace_location[trace_index - 1];
-                modify_index++;
-              }
-              trace_index--;
-            }
-          }
-        }
-      }
-      if (WIFSTOPPED(status) && WSTOPSIG(status) != 5)
-      {
-        break;
-      }
-      u64 stop_time = get_cur_time();
+  fn = alloc_printf("%s/%s/region_log", sync_dir, peer);
+  pos_fn = alloc_printf("%s/.synced/%s.region", out_dir, peer);
 
-      ptrace(PTRACE_CONT, pid, NULL, NULL);
+  fd = open(pos_fn, O_RDWR | O_CREAT, 0600);
+  if (fd < 0)
+    PFATAL("Unable to create '%s'", pos_fn);
 
-    }
+  if (read(fd, &pos, sizeof(u64)) > 0)
+    lseek(fd, 0, SEEK_SET);
 
-    close(fd_director);
-    u32 modify_time_s2 = get_cur_time();
+  /* The peer may have started over with a fresh log. */
 
-    // FILE *modify_record = fopen(modify_record_path, "a+");
-    // fprintf(modify_record, "a new modify i=%d\n", modify_index);
-    // total_edges=total_edges+modify_index;
-    // fclose(modify_record);
+  if (stat(fn, &st))
+    st.st_size = 0;
 
-    FILE *checker_file = fopen(checker_path, "rb+");
-    FILE *director_file = fopen(director_path, "rb+");
+  if (st.st_size < pos)
+    pos = 0;
 
-    unsigned char mdf_char[3] = {0x90, 0xeb, 0x00};
+  if (st.st_size > pos)
+  {
 
-    for (int i = 0; i < modify_index; i++)
-    {
+    map_nav_objects();
+    nav_set_init(&sites);
+    nav_set_init(&retire);
 
-      int offset = modify_locaion[i];
-      // fprintf(modify_record, "loc:0x%x ", offset);
-      fseek(director_file, offset - 1, SEEK_SET);
-      fwrite(mdf_char, sizeof(mdf_char), sizeof(char), director_file);
+    read_region_log(fn, &pos, &sites, &retire);
 
-      unsigned char bb_id[2] = {0, 0};
+    if (sites.count || retire.count)
+    {
 
-      for (int ii = 0; ii < 80; ii++)
+      if (!nav_live)
       {
-        if (bb_id[0] == 0 && bb_id[1] == 0)
-        {
-          if (w[offset + ii] == 0x48 && w[offset + ii + 1] == 0x35)
-          {
-            // fprintf(modify_record, "i=%d,%x %x ->", ii, w[offset + ii + 2], w[offset + ii + 3]);
-            bb_id[0] = w[offset + ii + 2];
-            bb_id[1] = w[offset + ii + 3] - 0xC0;
-
-            fseek(checker_file, offset + ii + 2, SEEK_SET);
-            fseek(director_file, offset + ii + 2, SEEK_SET);
-            fwrite(bb_id, sizeof(bb_id), sizeof(char), checker_file);
-            fwrite(bb_id, sizeof(bb_id), sizeof(char), director_file);
-            // fprintf(modify_record, "%x %x ,", bb_id[0], bb_id[1]);
-          }
-          else if (w[offset + ii] == 0x48 && w[offset + ii + 1] == 0x81)
-          {
-            // fprintf(modify_record, "i=%d,%x %x ->", ii, w[offset + ii + 3], w[offset + ii + 4]);
-            bb_id[0] = w[offset + ii + 3];
-            bb_id[1] = w[offset + ii + 4] - 0xC0;
-
-            fseek(checker_file, offset + ii + 3, SEEK_SET);
-            fseek(director_file, offset + ii + 3, SEEK_SET);
-            fwrite(bb_id, sizeof(bb_id), sizeof(char), checker_file);
-            fwrite(bb_id, sizeof(bb_id), sizeof(char), director_file);
-            // fprintf(modify_record, "%x %x ,", bb_id[0], bb_id[1]);
-          }
-        }
-        else
-        {
-          if (w[offset + ii] == (bb_id[0] >> 1) + 0x80 * ((bb_id[1] + 0xC0) % 2) && w[offset + ii + 1] == (bb_id[1] + 0xC0) >> 1)
-          {
-            bb_id[0] = (bb_id[0] >> 1) + 0x80 * ((bb_id[1] + 0xC0) % 2);
-            bb_id[1] = (bb_id[1]) >> 1;
-            // fprintf(modify_record, "%x %x\n", bb_id[0], bb_id[1]);
-            fseek(checker_file, offset + ii, SEEK_SET);
-            fseek(director_file, offset + ii, SEEK_SET);
-            fwrite(bb_id, sizeof(bb_id), sizeof(char), checker_file);
-            fwrite(bb_id, sizeof(bb_id), sizeof(char), director_file);
-            break;
-          }
-        }
+        stop_executors();
+        stop_nav_forkserver();
       }
-    }
 
-    // fclose(modify_record);
-    if (director_file != NULL)
-      fclose(director_file);
-    if (checker_file != NULL)
-      fclose(checker_file);
+      n = extend_nav_sites(&sites, 1);
+      nav_sites_patched += n;
+      nav_sites_synced += n;
 
-    init_forkserver(argv);
-    u32 modify_time_e = get_cur_time();
-    // modify_time = modify_time_e - modify_time_s + modify_time;
-    // FILE *modify_time_file = fopen(modify_time_path, "a+");
-    // fprintf(modify_time_file, "%d(%d);%d\n", modify_time_e - modify_time_s, modify_time_e - modify_time_s2, modify_time);
-    // fclose(modify_time_file);
+      retire_nav_sites(&retire, 1);
+
+      resume_nav_processes(argv);
+    }
+
+    unmap_nav_objects();
+    nav_set_free(&sites);
+    nav_set_free(&retire);
   }
+
+  ck_write(fd, &pos, sizeof(u64), pos_fn);
+
+  close(fd);
+  ck_free(fn);
+  ck_free(pos_fn);
 }
 
 /* Calibrate a new test case. This is done when processing the input directory
@@ -3215,10 +6076,15 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
   u8 fault = 0, new_bits = 0, var_detected = 0, hnb = 0, is_modify = 0,
      first_run = (q->exec_cksum == 0);
 
-  u64 start_us, stop_us;
+  u64 start_us, stop_us, run_us = 0;
 
   s32 old_sc = stage_cur, old_sm = stage_max;
-  u32 use_tmout = exec_tmout;
+  u64 use_tmout = exec_tmout_us;
+
+  u32 par = 1, me = cur_exec, round_cnt = 0, round_pos = 0, unreaped = 0, r;
+  u8 round_fault[MAX_EXECUTORS];
+
+  PROF_SCOPE(PROF_CALIBRATE);
   u8 *old_sn = stage_name;
 
   /* Be a bit more generous about timeouts when resuming sessions, or when
@@ -3226,8 +6092,8 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
      to intermittent latency. */
 
   if (!from_queue || resuming_fuzz)
-    use_tmout = MAX(exec_tmout + CAL_TMOUT_ADD,
-                    exec_tmout * CAL_TMOUT_PERC / 100);
+    use_tmout = MAX(exec_tmout_us + CAL_TMOUT_ADD * 1000,
+                    exec_tmout_us * CAL_TMOUT_PERC / 100);
 
   q->cal_failed++;
 
@@ -3248,17 +6114,22 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
       is_modify = has_new_modify(virgin_bits);
       if (is_modify == 1)
       {
-        total_edges = total_edges - count_virgin_bytes(virgin_bits);
-        modify_target(argv, use_tmout);
+        total_edges = total_edges - slice_cvg[0];
+        modify_target(argv, (use_tmout + 999) / 1000);
+
+        /* The navigator read the input through the same file offset, so
+           put the test case back before running it again. */
+
+        write_to_testcase(use_mem, q_len[q->id]);
         run_target(argv, use_tmout);
-        q->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+        q->exec_cksum = hash32(trace_bits, map_size, HASH_CONST);
       }
     }
-    memcpy(first_trace, trace_bits, MAP_SIZE);
+    memcpy(first_trace, trace_bits, map_size);
 
     hnb = has_new_bits(virgin_bits);
     if (is_modify)
-      total_edges = total_edges + count_virgin_bytes(virgin_bits);
+      total_edges = total_edges + slice_cvg[0];
 
     if (direct == 0 && (hnb == 3 || hnb == 4))
     {
@@ -3269,6 +6140,33 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
       new_bits = hnb;
   }
 
+  /* With -j, the cycles are run on all executors at once, a round at a
+     time; the whole round is reaped before any of it is judged, in
+     executor order. That's only safe if none of them holds a havoc run
+     that's yet to be judged, and runs are timed by the wall clock, so it
+     also takes every executor to have a core of its own. */
+
+  if (execs)
+  {
+
+    par = exec_cnt;
+
+    for (r = 0; r < exec_cnt; r++)
+      if (batch_state[r] != BATCH_IDLE || execs[r].cpu < 0)
+        par = 1;
+
+    for (r = 0; par > 1 && r < exec_cnt; r++)
+    {
+
+      select_executor(r);
+
+      if (!forksrv_pid)
+        init_forkserver(argv);
+    }
+
+    select_executor(me);
+  }
+
   start_us = get_cur_time_us();
 
   for (stage_cur = 0; stage_cur < stage_max; stage_cur++)
@@ -3279,9 +6177,52 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
     if (!first_run && !(stage_cur % stats_update_freq))
       show_stats();
 
-    write_to_testcase(use_mem, q->len);
+    if (par == 1)
+    {
+
+      write_to_testcase(use_mem, q_len[q->id]);
+
+      fault = run_target(argv, use_tmout);
+    }
+    else
+    {
+
+      if (round_pos == round_cnt)
+      {
+
+        round_cnt = MIN(par, stage_max - stage_cur);
+
+        for (round_pos = 0; round_pos < round_cnt; round_pos++)
+        {
+
+          select_executor((me + round_pos) % exec_cnt);
+          write_to_testcase(use_mem, q_len[q->id]);
+
+          if (!launch_target(argv))
+            break;
+        }
+
+        round_cnt = unreaped = round_pos;
+        round_pos = 0;
 
-    fault = run_target(argv, use_tmout);
+        if (stop_soon)
+          goto abort_calibration;
+
+        for (r = 0; r < round_cnt; r++)
+        {
+
+          select_executor((me + r) % exec_cnt);
+
+          round_fault[r] = reap_target(use_tmout);
+          run_us += last_exec_us;
+          unreaped--;
+        }
+      }
+
+      select_executor((me + round_pos) % exec_cnt);
+
+      fault = round_fault[round_pos++];
+    }
 
     /* stop_soon is set by the handler for Ctrl+C. When it's pressed,
        we want to bail out quickly. */
@@ -3295,7 +6236,7 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
       goto abort_calibration;
     }
 
-    cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    cksum = hash32(trace_bits, map_size, HASH_CONST);
 
     if (q->exec_cksum != cksum)
     {
@@ -3314,7 +6255,7 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
 
         u32 i;
 
-        for (i = 0; i < MAP_SIZE; i++)
+        for (i = 0; i < map_size; i++)
         {
 
           if (!var_bytes[i] && first_trace[i] != trace_bits[i])
@@ -3331,29 +6272,39 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
       {
 
         q->exec_cksum = cksum;
-        memcpy(first_trace, trace_bits, MAP_SIZE);
+        memcpy(first_trace, trace_bits, map_size);
       }
     }
   }
 
   stop_us = get_cur_time_us();
 
+  /* Runs that overlapped are accounted for by their own time, so that
+     the averages stay per run. */
+
+  if (par > 1)
+    stop_us = start_us + run_us;
+
   total_cal_us += stop_us - start_us;
   total_cal_cycles += stage_max;
 
   /* OK, let's collect some stats about the performance of this test case.
      This is used for fuzzing air time calculations in calculate_score(). */
 
-  q->exec_us = (stop_us - start_us) / stage_max;
+  q_exec_us[q->id] = (stop_us - start_us) / stage_max;
   q->bitmap_size = count_bytes(trace_bits);
-  q->bitmap_size_d = count_bytes_d(trace_bits);
-  if (q->bitmap_size_d > bitmap_size_d_max)
-    bitmap_size_d_max = q->bitmap_size_d;
-  if (q->bitmap_size_d < bitmap_size_d_max)
-    bitmap_size_d_min = q->bitmap_size_d;
+  q_bitmap_size_d[q->id] = count_bytes_d(trace_bits);
+  if (q_bitmap_size_d[q->id] > bitmap_size_d_max)
+    bitmap_size_d_max = q_bitmap_size_d[q->id];
+  if (q_bitmap_size_d[q->id] < bitmap_size_d_max)
+    bitmap_size_d_min = q_bitmap_size_d[q->id];
+  if (q_bitmap_size_d[q->id] < sched_d_min)
+    sched_d_min = q_bitmap_size_d[q->id];
   q->handicap = handicap;
   q->cal_failed = 0;
 
+  sched_update(q->id);
+
   total_bitmap_size += q->bitmap_size;
   total_bitmap_entries++;
 
@@ -3368,6 +6319,16 @@ static u8 calibrate_case(char **argv, struct queue_entry *q, u8 *use_mem,
 
 abort_calibration:
 
+  /* Runs of a round we didn't get to are reaped, but not looked at. */
+
+  while (unreaped)
+  {
+    select_executor((me + round_cnt - unreaped--) % exec_cnt);
+    reap_target(use_tmout);
+  }
+
+  select_executor(me);
+
   if (new_bits == direct * 2 + 2 && !q->has_new_cov)
   {
     q->has_new_cov = 1;
@@ -3408,31 +6369,160 @@ static void check_map_coverage(void)
   if (count_bytes(trace_bits) < 100)
     return;
 
-  for (i = (1 << (MAP_SIZE_POW2 - 1)); i < MAP_SIZE; i++)
+  for (i = map_size >> 1; i < map_size; i++)
     if (trace_bits[i])
       return;
 
   WARNF("Recompile binary with newer version of afl to improve coverage!");
 }
 
+/* Read the names of the target slots from the target table of an object.
+   Records are a 32-bit slot number and a NUL-terminated name, padded to four
+   bytes. */
+
+static void load_target_names(u8 *path)
+{
+
+  Elf64_Ehdr *ehdr;
+  Elf64_Shdr *shdr, *tab = NULL;
+  u8 *fdata, *names, *rec, *end;
+  u32 i, id;
+  s32 fd;
+  off_t fsize;
+
+  fd = open((char *)path, O_RDONLY);
+  if (fd < 0)
+    PFATAL("Unable to open '%s'", path);
+
+  fsize = lseek(fd, 0, SEEK_END);
+  fdata = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (fdata == MAP_FAILED)
+    PFATAL("mmap() failed on '%s'", path);
+
+  close(fd);
+
+  ehdr = (Elf64_Ehdr *)fdata;
+
+  if (fsize < sizeof(Elf64_Ehdr) || memcmp(fdata, ELFMAG, SELFMAG) ||
+      fdata[EI_CLASS] != ELFCLASS64)
+  {
+    munmap(fdata, fsize);
+    return;
+  }
+
+  shdr = (Elf64_Shdr *)(fdata + ehdr->e_shoff);
+  names = fdata + shdr[ehdr->e_shstrndx].sh_offset;
+
+  for (i = 0; i < ehdr->e_shnum; i++)
+    if (!strcmp((char *)names + shdr[i].sh_name, PDGF_TARGETS_SECTION))
+      tab = &shdr[i];
+
+  if (tab && tab->sh_type != SHT_NOBITS)
+  {
+
+    rec = fdata + tab->sh_offset;
+    end = rec + tab->sh_size;
+
+    while (rec + 4 < end)
+    {
+
+      u32 nlen = strnlen((char *)rec + 4, end - rec - 4);
+
+      id = *(u32 *)rec;
+
+      if (id < PDGF_MAX_TARGETS && !target_stats[id].name)
+      {
+        target_stats[id].name = ck_alloc(nlen + 1);
+        memcpy(target_stats[id].name, rec + 4, nlen);
+        targets_total++;
+      }
+
+      rec += (4 + nlen + 1 + 3) & ~3;
+    }
+  }
+
+  munmap(fdata, fsize);
+}
+
+/* Account for the targets the last exec reached, and save the input that
+   first got to each of them in <out_dir>/targets/. */
+
+static void check_targets(void *mem, u32 len)
+{
+
+  u64 *w = (u64 *)target_bits;
+  u32 i;
+  s32 fd;
+  u8 *fn;
+
+  for (i = 0; i < (PDGF_MAX_TARGETS >> 3); i++)
+    if (w[i])
+      break;
+
+  if (i == (PDGF_MAX_TARGETS >> 3))
+    return;
+
+  for (i = 0; i < PDGF_MAX_TARGETS; i++)
+  {
+
+    struct target_stat *t = &target_stats[i];
+
+    if (!target_bits[i])
+      continue;
+
+    t->hits++;
+
+    if (t->reached)
+      continue;
+
+    t->reached = 1;
+    t->first_ms = get_cur_time() - start_time;
+
+#ifndef SIMPLE_FILES
+
+    fn = alloc_printf("%s/targets/id:%06u,target:%02u,time:%llu", out_dir,
+                      targets_reached, i, t->first_ms);
+
+#else
+
+    fn = alloc_printf("%s/targets/id_%06u_%02u", out_dir, targets_reached, i);
+
+#endif /* ^!SIMPLE_FILES */
+
+    targets_reached++;
+
+    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      PFATAL("Unable to create '%s'", fn);
+    ck_write(fd, mem, len, fn);
+    close(fd);
+
+    ck_free(fn);
+  }
+}
+
 /* Perform dry run of all test cases to confirm that the app is working as
    expected. This is done only for the initial inputs, and only once. */
 
 static void perform_dry_run(char **argv)
 {
 
-  struct queue_entry *q = queue;
-  u32 cal_failures = 0;
+  struct queue_entry *q;
+  u32 i, cal_failures = 0;
   u8 *skip_crashes = getenv("AFL_SKIP_CRASHES");
 
-  while (q)
+  for (i = 0; i < queued_paths; i++)
   {
 
     u8 *use_mem;
     u8 res;
     s32 fd;
 
-    u8 *fn = strrchr(q->fname, '/') + 1;
+    u8 *fn;
+
+    q = queue_buf[i];
+    fn = strrchr(q->fname, '/') + 1;
 
     ACTF("Attempting dry run with '%s'...", fn);
 
@@ -3440,14 +6530,15 @@ static void perform_dry_run(char **argv)
     if (fd < 0)
       PFATAL("Unable to open '%s'", q->fname);
 
-    use_mem = ck_alloc_nozero(q->len);
+    use_mem = ck_alloc_nozero(q_len[q->id]);
 
-    if (read(fd, use_mem, q->len) != q->len)
+    if (read(fd, use_mem, q_len[q->id]) != q_len[q->id])
       FATAL("Short read from '%s'", q->fname);
 
     close(fd);
 
     res = calibrate_case(argv, q, use_mem, 0, 1);
+    check_targets(use_mem, q_len[q->id]);
     ck_free(use_mem);
 
     if (stop_soon)
@@ -3455,14 +6546,14 @@ static void perform_dry_run(char **argv)
 
     if (res == crash_mode || res == FAULT_NOBITS)
       SAYF(cGRA "    len = %u, map size = %u, exec speed = %llu us\n" cRST,
-           q->len, q->bitmap_size, q->exec_us);
+           q_len[q->id], q->bitmap_size, q_exec_us[q->id]);
 
     switch (res)
     {
 
     case FAULT_NONE:
 
-      if (q == queue)
+      if (!q->id)
         check_map_coverage();
 
       if (crash_mode)
@@ -3609,8 +6700,6 @@ static void perform_dry_run(char **argv)
 
     if (q->var_behavior)
       WARNF("Instrumentation output varies across runs.");
-
-    q = q->next;
   }
 
   if (cal_failures)
@@ -3672,17 +6761,20 @@ static void nuke_resume_dir(void);
 static void pivot_inputs(void)
 {
 
-  struct queue_entry *q = queue;
-  u32 id = 0;
+  struct queue_entry *q;
+  u32 id;
 
   ACTF("Creating hard links for all input files...");
 
-  while (q)
+  for (id = 0; id < queued_paths; id++)
   {
 
-    u8 *nfn, *rsl = strrchr(q->fname, '/');
+    u8 *nfn, *rsl;
     u32 orig_id;
 
+    q = queue_buf[id];
+    rsl = strrchr(q->fname, '/');
+
     if (!rsl)
       rsl = q->fname;
     else
@@ -3716,11 +6808,8 @@ static void pivot_inputs(void)
       if (src_str && sscanf(src_str + 1, "%06u", &src_id) == 1)
       {
 
-        struct queue_entry *s = queue;
-        while (src_id-- && s)
-          s = s->next;
-        if (s)
-          q->depth = s->depth + 1;
+        if (src_id < queued_paths)
+          q->depth = queue_buf[src_id]->depth + 1;
 
         if (max_depth < q->depth)
           max_depth = q->depth;
@@ -3759,9 +6848,6 @@ static void pivot_inputs(void)
 
     if (q->passed_det)
       mark_as_det_done(q);
-
-    q = q->next;
-    id++;
   }
 
   if (in_place_resume)
@@ -3886,16 +6972,17 @@ static u8 save_if_interesting(char **argv, void *mem, u32 len, u8 fault)
     {
       if (has_new_modify(virgin_bits))
       {
-        total_edges = total_edges - count_virgin_bytes(virgin_bits);
+        total_edges = total_edges - slice_cvg[0];
         modify_target(argv, exec_tmout);
-        run_target(argv, exec_tmout);
+        write_to_testcase(mem, len);
+        run_target(argv, cur_tmout_us);
         modify = 1;
       }
     }
 
     hnb = has_new_bits(virgin_bits);
     if (modify)
-      total_edges = total_edges + count_virgin_bytes(virgin_bits);
+      total_edges = total_edges + slice_cvg[0];
     if (direct == 0 && (hnb == 3 || hnb == 4))
     {
       direct = 1;
@@ -3907,6 +6994,8 @@ static u8 save_if_interesting(char **argv, void *mem, u32 len, u8 fault)
       return 0;
     }
 
+    credit_nav_exts(hnb);
+
 #ifndef SIMPLE_FILES
 
     fn = alloc_printf("%s/queue/id:%06u,%s", out_dir, queued_paths,
@@ -3926,7 +7015,7 @@ static u8 save_if_interesting(char **argv, void *mem, u32 len, u8 fault)
       queued_with_cov++;
     }
 
-    queue_top->exec_cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+    queue_top->exec_cksum = hash32(trace_bits, map_size, HASH_CONST);
 
     /* Try to calibrate inline; this also calls update_bitmap_score() when
        successful. */
@@ -3980,12 +7069,12 @@ static u8 save_if_interesting(char **argv, void *mem, u32 len, u8 fault)
        the target with a more generous timeout (unless the default timeout
        is already generous). */
 
-    if (exec_tmout < hang_tmout)
+    if (cur_tmout_us < hang_tmout * 1000ULL)
     {
 
       u8 new_fault;
       write_to_testcase(mem, len);
-      new_fault = run_target(argv, hang_tmout);
+      new_fault = run_target(argv, hang_tmout * 1000ULL);
 
       /* A corner case that one user reported bumping into: increasing the
          timeout actually uncovers a crash. Make sure we don't discard it if
@@ -4156,6 +7245,17 @@ static void find_timeout(void)
   (void)i; /* Ignore errors */
   close(fd);
 
+  /* Sessions that know about microseconds saved the exact value, too. */
+
+  off = strstr(tmp, "exec_timeout_us   : ");
+  if (off && atoll(off + 20) >= 100)
+  {
+    exec_tmout_us = atoll(off + 20);
+    exec_tmout = (exec_tmout_us + 999) / 1000;
+    timeout_given = 3;
+    return;
+  }
+
   off = strstr(tmp, "exec_timeout      : ");
   if (!off)
     return;
@@ -4165,6 +7265,7 @@ static void find_timeout(void)
     return;
 
   exec_tmout = ret;
+  exec_tmout_us = ret * 1000ULL;
   timeout_given = 3;
 }
 
@@ -4177,8 +7278,10 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps)
   static struct rusage usage;
 
   u8 *fn = alloc_printf("%s/fuzzer_stats", out_dir);
+  u8 key[64];
   s32 fd;
   FILE *f;
+  u32 i;
 
   fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
 
@@ -4232,11 +7335,19 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps)
              "last_hang         : %llu\n"
              "execs_since_crash : %llu\n"
              "exec_timeout      : %u\n" /* Must match find_timeout() */
+             "exec_timeout_us   : %llu\n" /* Same here */
+             "cur_timeout_us    : %llu\n"
              "afl_banner        : %s\n"
              "afl_version       : " VERSION "\n"
              "target_mode       : %s%s%s%s%s%s%s\n"
              "command_line      : %s\n"
-             "slowest_exec_ms   : %llu\n",
+             "slowest_exec_ms   : %llu\n"
+             "nav_sessions      : %llu\n"
+             "nav_truncated     : %llu\n"
+             "nav_timeouts      : %llu\n"
+             "nav_sites_patched : %llu\n"
+             "nav_sites_synced  : %llu\n"
+             "nav_sites_retired : %llu\n",
           start_time / 1000, get_cur_time() / 1000, getpid(),
           queue_cycle ? (queue_cycle - 1) : 0, total_execs, eps,
           queued_paths, queued_favored, queued_discovered, queued_imported,
@@ -4244,7 +7355,7 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps)
           queued_variable, stability, bitmap_cvg, unique_crashes,
           unique_hangs, last_path_time / 1000, last_crash_time / 1000,
           last_hang_time / 1000, total_execs - last_crash_execs,
-          exec_tmout, use_banner,
+          exec_tmout, exec_tmout_us, cur_tmout_us, use_banner,
           qemu_mode ? "qemu " : "", dumb_mode ? " dumb " : "",
           no_forkserver ? "no_forksrv " : "", crash_mode ? "crash " : "",
           persistent_mode ? "persistent " : "", deferred_mode ? "deferred " : "",
@@ -4252,9 +7363,57 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps)
            persistent_mode || deferred_mode)
               ? ""
               : "default",
-          orig_cmdline, slowest_exec_ms);
+          orig_cmdline, slowest_exec_ms, nav_sessions, nav_truncated,
+          nav_timeouts, nav_sites_patched, nav_sites_synced,
+          nav_sites_retired);
   /* ignore errors */
 
+  for (i = 0; i < PROF_COUNT; i++)
+  {
+
+    sprintf((char *)key, "prof_%s_ms", prof_names[i]);
+    fprintf(f, "%-18s: %0.0f\n", key, prof_ms(i));
+
+    sprintf((char *)key, "prof_%s_calls", prof_names[i]);
+    fprintf(f, "%-18s: %llu\n", key, prof_calls[i]);
+  }
+
+  if (targets_total)
+  {
+
+    u64 first = ~0ULL;
+
+    for (i = 0; i < PDGF_MAX_TARGETS; i++)
+      if (target_stats[i].reached && target_stats[i].first_ms < first)
+        first = target_stats[i].first_ms;
+
+    fprintf(f, "targets_total     : %u\n"
+               "targets_reached   : %u\n",
+            targets_total, targets_reached);
+
+    if (targets_reached)
+      fprintf(f, "time_to_target    : %llu\n", first);
+    else
+      fprintf(f, "time_to_target    : none\n");
+
+    for (i = 0; i < PDGF_MAX_TARGETS; i++)
+    {
+
+      struct target_stat *t = &target_stats[i];
+
+      if (!t->name)
+        continue;
+
+      sprintf((char *)key, "target_%02u", i);
+
+      if (t->reached)
+        fprintf(f, "%-18s: %s hits=%llu first_ms=%llu\n", key, t->name,
+                t->hits, t->first_ms);
+      else
+        fprintf(f, "%-18s: %s hits=0 first_ms=none\n", key, t->name);
+    }
+  }
+
   /* Get rss value from the children
      We must have killed the forkserver process and called waitpid
      before calling getrusage */
@@ -4278,6 +7437,23 @@ static void write_stats_file(double bitmap_cvg, double stability, double eps)
   fclose(f);
 }
 
+/* Append the current profiling counters to the timeline. */
+
+static void write_prof_timeline(void)
+{
+
+  u32 i;
+
+  fprintf(prof_file, "%llu,%llu", get_cur_time() / 1000, total_execs);
+
+  for (i = 0; i < PROF_COUNT; i++)
+    fprintf(prof_file, ",%0.0f,%llu", prof_ms(i), prof_calls[i]);
+
+  fputc('\n', prof_file);
+  fflush(prof_file);
+  /* ignore errors */
+}
+
 /* Update the plot file if there is a reason to. */
 
 static void maybe_update_plot_file(double bitmap_cvg, double eps)
@@ -4286,6 +7462,8 @@ static void maybe_update_plot_file(double bitmap_cvg, double eps)
   static u32 prev_qp, prev_pf, prev_pnf, prev_ce, prev_md;
   static u64 prev_qc, prev_uc, prev_uh;
 
+  u32 i;
+
   if (prev_qp == queued_paths && prev_pf == pending_favored &&
       prev_pnf == pending_not_fuzzed && prev_ce == current_entry &&
       prev_qc == queue_cycle && prev_uc == unique_crashes &&
@@ -4305,14 +7483,19 @@ static void maybe_update_plot_file(double bitmap_cvg, double eps)
 
      unix_time, cycles_done, cur_path, paths_total, paths_not_fuzzed,
      favored_not_fuzzed, unique_crashes, unique_hangs, max_depth,
-     execs_per_sec */
+     execs_per_sec, then the profiling counters in ms */
 
   fprintf(plot_file,
-          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f\n",
+          "%llu, %llu, %u, %u, %u, %u, %0.02f%%, %llu, %llu, %u, %0.02f",
           get_cur_time() / 1000, queue_cycle - 1, current_entry, queued_paths,
           pending_not_fuzzed, pending_favored, bitmap_cvg, unique_crashes,
           unique_hangs, max_depth, eps); /* ignore errors */
 
+  for (i = 0; i < PROF_COUNT; i++)
+    fprintf(plot_file, ", %0.0f", prof_ms(i));
+
+  fputc('\n', plot_file);
+
   fflush(plot_file);
 }
 
@@ -4685,6 +7868,11 @@ static void maybe_delete_out_dir(void)
     if (unlink(fn) && errno != ENOENT)
       goto dir_cleanup_failed;
     ck_free(fn);
+
+    fn = alloc_printf("%s/region_log", out_dir);
+    if (unlink(fn) && errno != ENOENT)
+      goto dir_cleanup_failed;
+    ck_free(fn);
   }
 
   fn = alloc_printf("%s/plot_data", out_dir);
@@ -4692,6 +7880,16 @@ static void maybe_delete_out_dir(void)
     goto dir_cleanup_failed;
   ck_free(fn);
 
+  fn = alloc_printf("%s/prof_timeline", out_dir);
+  if (unlink(fn) && errno != ENOENT)
+    goto dir_cleanup_failed;
+  ck_free(fn);
+
+  fn = alloc_printf("%s/targets", out_dir);
+  if (delete_files(fn, CASE_PREFIX))
+    goto dir_cleanup_failed;
+  ck_free(fn);
+
   OKF("Output dir cleanup successful.");
 
   /* Wow... is that all? If yes, celebrate! */
@@ -4721,7 +7919,7 @@ static void check_term_size(void);
 static void show_stats(void)
 {
 
-  static u64 last_stats_ms, last_plot_ms, last_ms, last_execs;
+  static u64 last_stats_ms, last_plot_ms, last_prof_ms, last_ms, last_execs;
   static double avg_exec;
   double t_byte_ratio, stab_ratio;
 
@@ -4778,7 +7976,7 @@ static void show_stats(void)
   /* Do some bitmap stats. */
 
   t_bytes = count_non_255_bytes(virgin_bits);
-  t_byte_ratio = ((double)t_bytes * 100) / MAP_SIZE;
+  t_byte_ratio = ((double)t_bytes * 100) / map_size;
 
   if (t_bytes)
     stab_ratio = 100 - ((double)var_byte_count) * 100 / t_bytes;
@@ -4798,11 +7996,20 @@ static void show_stats(void)
 
   /* Every now and then, write plot data. */
 
-  if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000)
+  if (cur_ms - last_plot_ms > PLOT_UPDATE_SEC * 1000)
+  {
+
+    last_plot_ms = cur_ms;
+    maybe_update_plot_file(t_byte_ratio, avg_exec);
+  }
+
+  /* Once a second, add a line to the profiling timeline. */
+
+  if (prof_file && cur_ms - last_prof_ms >= 1000)
   {
 
-    last_plot_ms = cur_ms;
-    maybe_update_plot_file(t_byte_ratio, avg_exec);
+    last_prof_ms = cur_ms;
+    write_prof_timeline();
   }
 
   /* Honor AFL_EXIT_WHEN_DONE and AFL_BENCH_UNTIL_CRASH. */
@@ -4821,7 +8028,7 @@ static void show_stats(void)
 
   /* Compute some mildly useful bitmap stats. */
 
-  t_bits = (MAP_SIZE << 3) - count_bits(virgin_bits);
+  t_bits = (map_size << 3) - count_bits(virgin_bits);
 
   /* Now, for the visuals... */
 
@@ -4958,12 +8165,12 @@ static void show_stats(void)
      put them in a temporary buffer first. */
 
   sprintf(tmp, "%s%s (%0.02f%%)", DI(current_entry),
-          queue_cur->favored ? "" : "*",
+          q_favored[queue_cur->id] ? "" : "*",
           ((double)current_entry * 100) / queued_paths);
 
   SAYF(bV bSTOP "  now processing : " cRST "%-17s " bSTG bV bSTOP, tmp);
 
-  sprintf(tmp, "%0.02f%% / %0.02f%%", ((double)queue_cur->bitmap_size) * 100 / MAP_SIZE, t_byte_ratio);
+  sprintf(tmp, "%0.02f%% / %0.02f%%", ((double)queue_cur->bitmap_size) * 100 / map_size, t_byte_ratio);
 
   SAYF("    map density : %s%-21s " bSTG bV "\n", t_byte_ratio > 70 ? cLRD : ((t_bytes < 200 && !dumb_mode) ? cPIN : cRST), tmp);
 
@@ -5211,8 +8418,8 @@ static void show_stats(void)
 static void show_init_stats(void)
 {
 
-  struct queue_entry *q = queue;
-  u32 min_bits = 0, max_bits = 0;
+  struct queue_entry *q;
+  u32 i, min_bits = 0, max_bits = 0;
   u64 min_us = 0, max_us = 0;
   u64 avg_us = 0;
   u32 max_len = 0;
@@ -5220,23 +8427,23 @@ static void show_init_stats(void)
   if (total_cal_cycles)
     avg_us = total_cal_us / total_cal_cycles;
 
-  while (q)
+  for (i = 0; i < queued_paths; i++)
   {
 
-    if (!min_us || q->exec_us < min_us)
-      min_us = q->exec_us;
-    if (q->exec_us > max_us)
-      max_us = q->exec_us;
+    q = queue_buf[i];
+
+    if (!min_us || q_exec_us[i] < min_us)
+      min_us = q_exec_us[i];
+    if (q_exec_us[i] > max_us)
+      max_us = q_exec_us[i];
 
     if (!min_bits || q->bitmap_size < min_bits)
       min_bits = q->bitmap_size;
     if (q->bitmap_size > max_bits)
       max_bits = q->bitmap_size;
 
-    if (q->len > max_len)
-      max_len = q->len;
-
-    q = q->next;
+    if (q_len[i] > max_len)
+      max_len = q_len[i];
   }
 
   SAYF("\n");
@@ -5303,6 +8510,8 @@ static void show_init_stats(void)
     if (exec_tmout > EXEC_TIMEOUT)
       exec_tmout = EXEC_TIMEOUT;
 
+    exec_tmout_us = exec_tmout * 1000ULL;
+
     ACTF("No -t option specified, so I'll use exec timeout of %u ms.",
          exec_tmout);
 
@@ -5320,6 +8529,12 @@ static void show_init_stats(void)
   if (dumb_mode && !getenv("AFL_HANG_TMOUT"))
     hang_tmout = MIN(EXEC_TIMEOUT, exec_tmout * 2 + 100);
 
+  cur_tmout_us = exec_tmout_us;
+
+  if (adaptive_tmout)
+    ACTF("Adaptive timeouts enabled, up to %0.02f ms per entry.",
+         exec_tmout_us / 1000.0);
+
   OKF("All set and ready to roll!");
 }
 
@@ -5350,19 +8565,21 @@ static u8 trim_case(char **argv, struct queue_entry *q, u8 *in_buf)
   u32 remove_len;
   u32 len_p2;
 
+  PROF_SCOPE(PROF_TRIM);
+
   /* Although the trimmer will be less useful when variable behavior is
      detected, it will still work to some extent, so we don't check for
      this. */
 
-  if (q->len < 5)
+  if (q_len[q->id] < 5)
     return 0;
 
   stage_name = tmp;
-  bytes_trim_in += q->len;
+  bytes_trim_in += q_len[q->id];
 
   /* Select initial chunk len, starting with large steps. */
 
-  len_p2 = next_p2(q->len);
+  len_p2 = next_p2(q_len[q->id]);
 
   remove_len = MAX(len_p2 / TRIM_START_STEPS, TRIM_MIN_BYTES);
 
@@ -5377,17 +8594,17 @@ static u8 trim_case(char **argv, struct queue_entry *q, u8 *in_buf)
     sprintf(tmp, "trim %s/%s", DI(remove_len), DI(remove_len));
 
     stage_cur = 0;
-    stage_max = q->len / remove_len;
+    stage_max = q_len[q->id] / remove_len;
 
-    while (remove_pos < q->len)
+    while (remove_pos < q_len[q->id])
     {
 
-      u32 trim_avail = MIN(remove_len, q->len - remove_pos);
+      u32 trim_avail = MIN(remove_len, q_len[q->id] - remove_pos);
       u32 cksum;
 
-      write_with_gap(in_buf, q->len, remove_pos, trim_avail);
+      write_with_gap(in_buf, q_len[q->id], remove_pos, trim_avail);
 
-      fault = run_target(argv, exec_tmout);
+      fault = run_target(argv, cur_tmout_us);
       trim_execs++;
 
       if (stop_soon || fault == FAULT_ERROR)
@@ -5395,7 +8612,7 @@ static u8 trim_case(char **argv, struct queue_entry *q, u8 *in_buf)
 
       /* Note that we don't keep track of crashes or hangs here; maybe TODO? */
 
-      cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+      cksum = hash32(trace_bits, map_size, HASH_CONST);
 
       /* If the deletion had no impact on the trace, make it permanent. This
          isn't perfect for variable-path inputs, but we're just making a
@@ -5405,10 +8622,10 @@ static u8 trim_case(char **argv, struct queue_entry *q, u8 *in_buf)
       if (cksum == q->exec_cksum)
       {
 
-        u32 move_tail = q->len - remove_pos - trim_avail;
+        u32 move_tail = q_len[q->id] - remove_pos - trim_avail;
 
-        q->len -= trim_avail;
-        len_p2 = next_p2(q->len);
+        q_len[q->id] -= trim_avail;
+        len_p2 = next_p2(q_len[q->id]);
 
         memmove(in_buf + remove_pos, in_buf + remove_pos + trim_avail,
                 move_tail);
@@ -5420,7 +8637,7 @@ static u8 trim_case(char **argv, struct queue_entry *q, u8 *in_buf)
         {
 
           needs_write = 1;
-          memcpy(clean_trace, trace_bits, MAP_SIZE);
+          memcpy(clean_trace, trace_bits, map_size);
         }
       }
       else
@@ -5451,43 +8668,69 @@ static u8 trim_case(char **argv, struct queue_entry *q, u8 *in_buf)
     if (fd < 0)
       PFATAL("Unable to create '%s'", q->fname);
 
-    ck_write(fd, in_buf, q->len, q->fname);
+    ck_write(fd, in_buf, q_len[q->id], q->fname);
     close(fd);
 
-    memcpy(trace_bits, clean_trace, MAP_SIZE);
+    memcpy(trace_bits, clean_trace, map_size);
     update_bitmap_score(q);
   }
 
 abort_trimming:
 
-  bytes_trim_out += q->len;
+  bytes_trim_out += q_len[q->id];
   return fault;
 }
 
-/* Write a modified test case, run program, process results. Handle
-   error conditions, returning 1 if it's time to bail out. This is
-   a helper function for fuzz_one(). */
+static int compare_u64(const void *a, const void *b)
+{
 
-EXP_ST u8 common_fuzz_stuff(char **argv, u8 *out_buf, u32 len)
+  u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Timeout for fuzzing an entry with AFL_ADAPTIVE_TMOUT: a multiple of the
+   larger of its own calibrated exec time and the ADAPT_TMOUT_PERC-th
+   percentile over the queue, so that a mostly quick queue doesn't get to
+   spin for the whole -t on every hang. The percentile is only worked out
+   again once the queue has grown. */
+
+static u64 adaptive_tmout_us(u32 id)
 {
 
-  u8 fault;
+  static u64 *sorted, perc_us;
+  static u32 sorted_cnt;
 
-  if (post_handler)
+  u64 tmout;
+
+  if (sorted_cnt != queued_paths)
   {
 
-    out_buf = post_handler(out_buf, &len);
-    if (!out_buf || !len)
-      return 0;
+    sorted = ck_realloc(sorted, queued_paths * sizeof(u64));
+    memcpy(sorted, q_exec_us, queued_paths * sizeof(u64));
+    qsort(sorted, queued_paths, sizeof(u64), compare_u64);
+
+    perc_us = sorted[(queued_paths - 1) * ADAPT_TMOUT_PERC / 100];
+    sorted_cnt = queued_paths;
   }
 
-  write_to_testcase(out_buf, len);
+  tmout = MAX(q_exec_us[id], perc_us) * ADAPT_TMOUT_MULT;
+  tmout = MAX(tmout, ADAPT_TMOUT_MIN_US);
+
+  return MIN(tmout, exec_tmout_us);
+}
+
+/* Handle the outcome of a run of out_buf: bookkeeping, saving, stats.
+   Returns 1 if it's time to bail out. */
 
-  fault = run_target(argv, exec_tmout);
+static u8 judge_fuzz_run(char **argv, u8 *out_buf, u32 len, u8 fault)
+{
 
   if (stop_soon)
     return 1;
 
+  check_targets(out_buf, len);
+
   if (fault == FAULT_TMOUT)
   {
 
@@ -5521,6 +8764,172 @@ EXP_ST u8 common_fuzz_stuff(char **argv, u8 *out_buf, u32 len)
   return 0;
 }
 
+/* Write a modified test case, run program, process results. Handle
+   error conditions, returning 1 if it's time to bail out. This is
+   a helper function for fuzz_one(). */
+
+EXP_ST u8 common_fuzz_stuff(char **argv, u8 *out_buf, u32 len)
+{
+
+  u8 fault;
+
+  if (post_handler)
+  {
+
+    out_buf = post_handler(out_buf, &len);
+    if (!out_buf || !len)
+      return 0;
+  }
+
+  write_to_testcase(out_buf, len);
+
+  fault = run_target(argv, cur_tmout_us);
+
+  return judge_fuzz_run(argv, out_buf, len, fault);
+}
+
+/* Collect the outcome of executor k's run, reaping it first if it's still
+   in flight, and judge it unless 'judge' is 0. A run that was reaped early
+   is run again: the director has been patched since, so its map would be
+   judged against a region it wasn't run with. Returns 1 if it's time to
+   bail out. */
+
+static u8 retire_run(char **argv, u32 k, u8 judge)
+{
+
+  u8 fault = FAULT_NONE, ret = 0;
+
+  select_executor(k);
+
+  if (batch_state[k] == BATCH_RUNNING)
+  {
+    PROF_SCOPE(PROF_RUN_TARGET);
+    fault = reap_target(cur_tmout_us);
+  }
+  else if (judge)
+  {
+
+    /* The checker may have taken over executor 0's input meanwhile. */
+
+    write_to_testcase(batch_buf[k], batch_len[k]);
+    fault = run_target(argv, cur_tmout_us);
+  }
+
+  batch_state[k] = BATCH_IDLE;
+
+  if (judge)
+    ret = judge_fuzz_run(argv, batch_buf[k], batch_len[k], fault);
+
+  select_executor(0);
+
+  return ret;
+}
+
+/* Reap every run still in flight, leaving it for retire_run() to run
+   again. Needed before the forkservers are stopped or patched. */
+
+static void drain_executors(void)
+{
+
+  u32 i, me = cur_exec;
+
+  for (i = 0; i < exec_cnt; i++)
+  {
+
+    if (batch_state[i] != BATCH_RUNNING)
+      continue;
+
+    select_executor(i);
+    reap_target(cur_tmout_us);
+    batch_state[i] = BATCH_STALE;
+  }
+
+  select_executor(me);
+}
+
+/* Retire all outstanding runs, oldest first, at the end of a stage. Once
+   one of them says to bail out, the rest are reaped, but not judged. */
+
+static u8 flush_batch(char **argv)
+{
+
+  u32 i;
+  u8 ret = 0;
+
+  for (i = 0; i < exec_cnt; i++)
+  {
+
+    u32 k = (batch_next + i) % exec_cnt;
+
+    if (batch_state[k] != BATCH_IDLE && retire_run(argv, k, !ret))
+      ret = 1;
+  }
+
+  batch_next = 0;
+
+  return ret;
+}
+
+/* Havoc mutants don't depend on each other's results, so they are pipelined
+   through the executors: the mutant goes to the executor whose run is the
+   oldest, once that run has been judged. While we judge it and come up with
+   the next mutant, the other executors keep running theirs. With a single
+   executor, that still has the next mutant made while the last one runs.
+   Without a forkserver, there's nothing to launch and come back to later.
+   Returns 1 if it's time to bail out. */
+
+static u8 batch_fuzz_stuff(char **argv, u8 *out_buf, u32 len)
+{
+
+  u32 k = batch_next;
+
+  if (dumb_mode == 1 || no_forkserver)
+    return common_fuzz_stuff(argv, out_buf, len);
+
+  if (post_handler)
+  {
+
+    out_buf = post_handler(out_buf, &len);
+    if (!out_buf || !len)
+      return 0;
+  }
+
+  if (batch_state[k] != BATCH_IDLE && retire_run(argv, k, 1))
+  {
+    flush_batch(argv);
+    return 1;
+  }
+
+  if (batch_cap[k] < len)
+  {
+    batch_buf[k] = ck_realloc(batch_buf[k], len);
+    batch_cap[k] = len;
+  }
+
+  memcpy(batch_buf[k], out_buf, len);
+  batch_len[k] = len;
+
+  select_executor(k);
+  write_to_testcase(batch_buf[k], len);
+
+  {
+    PROF_SCOPE(PROF_RUN_TARGET);
+
+    if (!launch_target(argv))
+    {
+      select_executor(0);
+      return 1;
+    }
+  }
+
+  batch_state[k] = BATCH_RUNNING;
+  batch_next = (k + 1) % exec_cnt;
+
+  select_executor(0);
+
+  return 0;
+}
+
 /* Helper to choose random block len for block operations in fuzz_one().
    Doesn't return zero, provided that max_len is > 0. */
 
@@ -5579,23 +8988,25 @@ static u32 calculate_score(struct queue_entry *q)
   u32 avg_bitmap_size = total_bitmap_size / total_bitmap_entries;
   u32 perf_score = 100;
 
+  PROF_SCOPE(PROF_SCORE);
+
   /* Adjust score based on execution speed of this path, compared to the
      global average. Multiplier ranges from 0.1x to 3x. Fast inputs are
      less expensive to fuzz, so we're giving them more air time. */
 
-  if (q->exec_us * 0.1 > avg_exec_us)
+  if (q_exec_us[q->id] * 0.1 > avg_exec_us)
     perf_score = 10;
-  else if (q->exec_us * 0.25 > avg_exec_us)
+  else if (q_exec_us[q->id] * 0.25 > avg_exec_us)
     perf_score = 25;
-  else if (q->exec_us * 0.5 > avg_exec_us)
+  else if (q_exec_us[q->id] * 0.5 > avg_exec_us)
     perf_score = 50;
-  else if (q->exec_us * 0.75 > avg_exec_us)
+  else if (q_exec_us[q->id] * 0.75 > avg_exec_us)
     perf_score = 75;
-  else if (q->exec_us * 4 < avg_exec_us)
+  else if (q_exec_us[q->id] * 4 < avg_exec_us)
     perf_score = 300;
-  else if (q->exec_us * 3 < avg_exec_us)
+  else if (q_exec_us[q->id] * 3 < avg_exec_us)
     perf_score = 200;
-  else if (q->exec_us * 2 < avg_exec_us)
+  else if (q_exec_us[q->id] * 2 < avg_exec_us)
     perf_score = 150;
 
   /* Adjust score based on bitmap size. The working theory is that better
@@ -5656,7 +9067,7 @@ static u32 calculate_score(struct queue_entry *q)
   u64 cur_ms = get_cur_time();
   u64 t = (cur_ms - start_time) / 1000;
 
-  u64 edges_cur = count_virgin_bytes(virgin_bits);
+  u64 edges_cur = slice_cvg[0];
   double progress_to_tx = ((double)edges_cur) / ((double)total_edges);
 
   double ft = 0.6 + pow(((double)t) / ((double)6000), 0.5);
@@ -5673,12 +9084,12 @@ static u32 calculate_score(struct queue_entry *q)
 
   double power_factor = 1.0;
 
-  if (q->bitmap_size_d > 0)
+  if (q_bitmap_size_d[q->id] > 0)
   {
 
     double normalized_d = 0; // when "max_distance == min_distance", we set the normalized_d to 0 so that we can sufficiently explore those testcases whose distance >= 0.
     if (bitmap_size_d_max != bitmap_size_d_min)
-      normalized_d = (q->bitmap_size_d - bitmap_size_d_min) / (bitmap_size_d_max - bitmap_size_d_min);
+      normalized_d = (q_bitmap_size_d[q->id] - bitmap_size_d_min) / (bitmap_size_d_max - bitmap_size_d_min);
 
     if (normalized_d >= 0)
     {
@@ -5940,25 +9351,32 @@ static u8 fuzz_one(char **argv)
 
 #else
 
-  if (pending_favored)
+  /* The heap scheduler has already picked the most promising entry, so the
+     skipping below is only for the linear walk. */
+
+  if (heap_sched)
+  {
+    /* Nothing to skip. */
+  }
+  else if (pending_favored)
   {
 
     /* If we have any favored, non-fuzzed new arrivals in the queue,
        possibly skip to them at the expense of already-fuzzed or non-favored
        cases. */
 
-    if ((queue_cur->was_fuzzed || !queue_cur->favored) &&
+    if ((q_was_fuzzed[queue_cur->id] || !q_favored[queue_cur->id]) &&
         UR(100) < SKIP_TO_NEW_PROB)
       return 1;
   }
-  else if (!dumb_mode && !queue_cur->favored && queued_paths > 10)
+  else if (!dumb_mode && !q_favored[queue_cur->id] && queued_paths > 10)
   {
 
     /* Otherwise, still possibly skip non-favored cases, albeit less often.
        The odds of skipping stuff are higher for already-fuzzed inputs and
        lower for never-fuzzed entries. */
 
-    if (queue_cycle > 1 && !queue_cur->was_fuzzed)
+    if (queue_cycle > 1 && !q_was_fuzzed[queue_cur->id])
     {
 
       if (UR(100) < SKIP_NFAV_NEW_PROB)
@@ -5981,6 +9399,9 @@ static u8 fuzz_one(char **argv)
     fflush(stdout);
   }
 
+  if (adaptive_tmout)
+    cur_tmout_us = adaptive_tmout_us(queue_cur->id);
+
   /* Map the test case into memory. */
 
   fd = open(queue_cur->fname, O_RDONLY);
@@ -5988,7 +9409,7 @@ static u8 fuzz_one(char **argv)
   if (fd < 0)
     PFATAL("Unable to open '%s'", queue_cur->fname);
 
-  len = queue_cur->len;
+  len = q_len[queue_cur->id];
 
   orig_in = in_buf = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 
@@ -6060,8 +9481,8 @@ static u8 fuzz_one(char **argv)
 
     queue_cur->trim_done = 1;
 
-    if (len != queue_cur->len)
-      len = queue_cur->len;
+    if (len != q_len[queue_cur->id])
+      len = q_len[queue_cur->id];
   }
 
   memcpy(out_buf, in_buf, len);
@@ -6076,13 +9497,13 @@ static u8 fuzz_one(char **argv)
      this entry ourselves (was_fuzzed), or if it has gone through deterministic
      testing in earlier, resumed runs (passed_det). */
 
-  u64 edges_cur = count_virgin_bytes(virgin_bits);
+  u64 edges_cur = slice_cvg[0];
   double progress_to_tx = ((double)edges_cur) / ((double)total_edges * threshold); 
   goto havoc_stage;                                                                // havoc
   if (progress_to_tx <= 1)
     goto havoc_stage;
 
-  if (skip_deterministic || queue_cur->was_fuzzed || queue_cur->passed_det)
+  if (skip_deterministic || q_was_fuzzed[queue_cur->id] || queue_cur->passed_det)
     goto havoc_stage;
 
   /* Skip deterministic fuzzing if exec path checksum puts this out of scope
@@ -6159,7 +9580,7 @@ static u8 fuzz_one(char **argv)
     if (!dumb_mode && (stage_cur & 7) == 7)
     {
 
-      u32 cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+      u32 cksum = hash32(trace_bits, map_size, HASH_CONST);
 
       if (stage_cur == stage_max - 1 && cksum == prev_cksum)
       {
@@ -6322,7 +9743,7 @@ static u8 fuzz_one(char **argv)
          without wasting time on checksums. */
 
       if (!dumb_mode && len >= EFF_MIN_LEN)
-        cksum = hash32(trace_bits, MAP_SIZE, HASH_CONST);
+        cksum = hash32(trace_bits, map_size, HASH_CONST);
       else
         cksum = ~queue_cur->exec_cksum;
 
@@ -7574,7 +10995,7 @@ havoc_stage:
       }
     }
 
-    if (common_fuzz_stuff(argv, out_buf, temp_len))
+    if (batch_fuzz_stuff(argv, out_buf, temp_len))
       goto abandon_entry;
 
     /* out_buf might have been mangled a bit, so let's restore it to its
@@ -7601,6 +11022,9 @@ havoc_stage:
     }
   }
 
+  if (flush_batch(argv))
+    goto abandon_entry;
+
   new_hit_cnt = queued_paths + unique_crashes;
 
   if (!splice_cycle)
@@ -7628,7 +11052,7 @@ havoc_stage:
 retry_splicing:
 
   if (use_splicing && splice_cycle++ < SPLICE_CYCLES &&
-      queued_paths > 1 && queue_cur->len > 1)
+      queued_paths > 1 && q_len[queue_cur->id] > 1)
   {
 
     struct queue_entry *target;
@@ -7643,7 +11067,7 @@ retry_splicing:
     {
       ck_free(in_buf);
       in_buf = orig_in;
-      len = queue_cur->len;
+      len = q_len[queue_cur->id];
     }
 
     /* Pick a random queue entry and seek to it. Don't splice with yourself. */
@@ -7654,27 +11078,18 @@ retry_splicing:
     } while (tid == current_entry);
 
     splicing_with = tid;
-    target = queue;
-
-    while (tid >= 100)
-    {
-      target = target->next_100;
-      tid -= 100;
-    }
-    while (tid--)
-      target = target->next;
 
     /* Make sure that the target has a reasonable length. */
 
-    while (target && (target->len < 2 || target == queue_cur))
-    {
-      target = target->next;
+    while (splicing_with < queued_paths &&
+           (q_len[splicing_with] < 2 || splicing_with == current_entry))
       splicing_with++;
-    }
 
-    if (!target)
+    if (splicing_with == queued_paths)
       goto retry_splicing;
 
+    target = queue_buf[splicing_with];
+
     /* Read the testcase into a new buffer. */
 
     fd = open(target->fname, O_RDONLY);
@@ -7682,9 +11097,9 @@ retry_splicing:
     if (fd < 0)
       PFATAL("Unable to open '%s'", target->fname);
 
-    new_buf = ck_alloc_nozero(target->len);
+    new_buf = ck_alloc_nozero(q_len[target->id]);
 
-    ck_read(fd, new_buf, target->len, target->fname);
+    ck_read(fd, new_buf, q_len[target->id], target->fname);
 
     close(fd);
 
@@ -7692,7 +11107,7 @@ retry_splicing:
        the last differing byte. Bail out if the difference is just a single
        byte or so. */
 
-    locate_diffs(in_buf, new_buf, MIN(len, target->len), &f_diff, &l_diff);
+    locate_diffs(in_buf, new_buf, MIN(len, q_len[target->id]), &f_diff, &l_diff);
 
     if (f_diff < 0 || l_diff < 2 || f_diff == l_diff)
     {
@@ -7706,7 +11121,7 @@ retry_splicing:
 
     /* Do the thing. */
 
-    len = target->len;
+    len = q_len[target->id];
     memcpy(new_buf, in_buf, split_at);
     in_buf = new_buf;
 
@@ -7728,15 +11143,15 @@ abandon_entry:
   /* Update pending_not_fuzzed count if we made it through the calibration
      cycle and have not seen this entry before. */
 
-  if (!stop_soon && !queue_cur->cal_failed && !queue_cur->was_fuzzed)
+  if (!stop_soon && !queue_cur->cal_failed && !q_was_fuzzed[queue_cur->id])
   {
-    queue_cur->was_fuzzed = 1;
+    q_was_fuzzed[queue_cur->id] = 1;
     pending_not_fuzzed--;
-    if (queue_cur->favored)
+    if (q_favored[queue_cur->id])
       pending_favored--;
   }
 
-  munmap(orig_in, queue_cur->len);
+  munmap(orig_in, q_len[queue_cur->id]);
 
   if (in_buf != orig_in)
     ck_free(in_buf);
@@ -7757,6 +11172,8 @@ static void sync_fuzzers(char **argv)
   struct dirent *sd_ent;
   u32 sync_cnt = 0;
 
+  PROF_SCOPE(PROF_SYNC);
+
   sd = opendir(sync_dir);
   if (!sd)
     PFATAL("Unable to open '%s'", sync_dir);
@@ -7793,6 +11210,11 @@ static void sync_fuzzers(char **argv)
       continue;
     }
 
+    /* Pick up the peer's region extensions first, so that its test cases
+       run against the same region. */
+
+    sync_region_log(argv, (u8 *)sd_ent->d_name);
+
     /* Retrieve the ID of the last seen test case. */
 
     qd_synced_path = alloc_printf("%s/.synced/%s", out_dir, sd_ent->d_name);
@@ -7865,11 +11287,13 @@ static void sync_fuzzers(char **argv)
 
         write_to_testcase(mem, st.st_size);
 
-        fault = run_target(argv, exec_tmout);
+        fault = run_target(argv, exec_tmout_us);
 
         if (stop_soon)
           return;
 
+        check_targets(mem, st.st_size);
+
         syncing_party = sd_ent->d_name;
         queued_imported += save_if_interesting(argv, mem, st.st_size, fault);
         syncing_party = 0;
@@ -7900,12 +11324,30 @@ static void sync_fuzzers(char **argv)
 static void handle_stop_sig(int sig)
 {
 
+  u32 i;
+
   stop_soon = 1;
 
   if (child_pid > 0)
     kill(child_pid, SIGKILL);
   if (forksrv_pid > 0)
     kill(forksrv_pid, SIGKILL);
+  if (nav_fsrv_pid > 0)
+    kill(nav_fsrv_pid, SIGKILL);
+
+  /* The executors that aren't selected keep their pids in execs[]. */
+
+  for (i = 0; execs && i < exec_cnt; i++)
+  {
+
+    if (i == cur_exec)
+      continue;
+
+    if (execs[i].child_pid > 0)
+      kill(execs[i].child_pid, SIGKILL);
+    if (execs[i].forksrv_pid > 0)
+      kill(execs[i].forksrv_pid, SIGKILL);
+  }
 }
 
 /* Handle skip request (SIGUSR1). */
@@ -8209,8 +11651,10 @@ static void usage(u8 *argv0)
        "Execution control settings:\n\n"
 
        "  -f file       - location read by the fuzzed program (stdin)\n"
-       "  -t msec       - timeout for each run (auto-scaled, 50-%u ms)\n"
+       "  -t msec       - timeout for each run (auto-scaled, 50-%u ms;\n"
+       "                  fractions allowed)\n"
        "  -m megs       - memory limit for child process (%u MB)\n"
+       "  -j count      - run the target as this many executors (1-%u)\n"
        "  -Q            - use binary-only instrumentation (QEMU mode)\n\n"
 
        "Fuzzing behavior settings:\n\n"
@@ -8229,7 +11673,7 @@ static void usage(u8 *argv0)
 
        "For additional tips, please consult %s/README.\n\n",
 
-       argv0, EXEC_TIMEOUT, MEM_LIMIT, doc_path);
+       argv0, EXEC_TIMEOUT, MEM_LIMIT, MAX_EXECUTORS, doc_path);
 
   exit(1);
 }
@@ -8241,6 +11685,7 @@ EXP_ST void setup_dirs_fds(void)
 
   u8 *tmp;
   s32 fd;
+  u32 i;
 
   ACTF("Setting up output directories...");
 
@@ -8342,6 +11787,13 @@ EXP_ST void setup_dirs_fds(void)
     PFATAL("Unable to create '%s'", tmp);
   ck_free(tmp);
 
+  /* First inputs to reach each target. */
+
+  tmp = alloc_printf("%s/targets", out_dir);
+  if (mkdir(tmp, 0700))
+    PFATAL("Unable to create '%s'", tmp);
+  ck_free(tmp);
+
   /* Generally useful file descriptors. */
 
   dev_null_fd = open("/dev/null", O_RDWR);
@@ -8366,8 +11818,36 @@ EXP_ST void setup_dirs_fds(void)
 
   fprintf(plot_file, "# unix_time, cycles_done, cur_path, paths_total, "
                      "pending_total, pending_favs, map_size, unique_crashes, "
-                     "unique_hangs, max_depth, execs_per_sec\n");
+                     "unique_hangs, max_depth, execs_per_sec");
+
+  for (i = 0; i < PROF_COUNT; i++)
+    fprintf(plot_file, ", prof_%s_ms", prof_names[i]);
+
+  fputc('\n', plot_file);
   /* ignore errors */
+
+  /* Per-second profiling timeline, if asked for. */
+
+  if (getenv("AFL_PROF_TIMELINE"))
+  {
+
+    tmp = alloc_printf("%s/prof_timeline", out_dir);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      PFATAL("Unable to create '%s'", tmp);
+    ck_free(tmp);
+
+    prof_file = fdopen(fd, "w");
+    if (!prof_file)
+      PFATAL("fdopen() failed");
+
+    fprintf(prof_file, "unix_time,execs_done");
+
+    for (i = 0; i < PROF_COUNT; i++)
+      fprintf(prof_file, ",%s_ms,%s_calls", prof_names[i], prof_names[i]);
+
+    fputc('\n', prof_file);
+  }
 }
 
 /* Setup the output file for fuzzed data, if not using -f. */
@@ -8688,6 +12168,28 @@ static void check_asan_opts(void)
   }
 }
 
+/* Create the @@ file as a memfd at MEMFD_INPUT_FD. The descriptor is
+   inherited by the forkservers and their children, so the target can open
+   it by its /proc/self/fd path without the file ever hitting the disk. */
+
+static void setup_memfd_file(void)
+{
+
+  s32 fd = memfd_create("pdgf_input", 0);
+
+  if (fd < 0)
+    PFATAL("memfd_create() failed");
+
+  if (dup2(fd, MEMFD_INPUT_FD) < 0)
+    PFATAL("dup2() failed");
+
+  close(fd);
+
+  memfd_input = 1;
+  out_fd = MEMFD_INPUT_FD;
+  out_file = alloc_printf("/proc/self/fd/%u", MEMFD_INPUT_FD);
+}
+
 /* Detect @@ in args. */
 
 EXP_ST void detect_file_args(char **argv)
@@ -8711,7 +12213,9 @@ EXP_ST void detect_file_args(char **argv)
 
       /* If we don't have a file name chosen yet, use a safe default. */
 
-      if (!out_file)
+      if (!out_file && getenv("AFL_MEMFD_INPUT"))
+        setup_memfd_file();
+      else if (!out_file)
         out_file = alloc_printf("%s/.cur_input", out_dir);
 
       /* Be sure that we're always using fully-qualified paths. */
@@ -8894,7 +12398,7 @@ int main(int argc, char **argv)
   direct = 0;
   s32 opt;
   u64 prev_queued = 0;
-  u32 sync_interval_cnt = 0, seek_to;
+  u32 sync_interval_cnt = 0, seek_to, cycle_picks = 0, i;
   u8 *extras_dir = 0;
   u8 mem_limit_given = 0;
   u8 exit_1 = !!getenv("AFL_BENCH_JUST_ONE");
@@ -8910,7 +12414,10 @@ int main(int argc, char **argv)
   gettimeofday(&tv, &tz);
   srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
 
-  while ((opt = getopt(argc, argv, "+e:i:o:f:m:b:t:T:dnCB:S:M:x:QV")) > 0)
+  prof_base_ticks = prof_clock();
+  prof_base_us = get_cur_time_us();
+
+  while ((opt = getopt(argc, argv, "+e:i:o:f:m:b:j:t:T:dnCB:S:M:x:QV")) > 0)
 
     switch (opt)
     {
@@ -8988,19 +12495,27 @@ int main(int argc, char **argv)
     case 't':
     { /* timeout */
 
-      u8 suffix = 0;
+      u8 *suffix;
+      double tmout_ms;
 
       if (timeout_given)
         FATAL("Multiple -t options not supported");
 
-      if (sscanf(optarg, "%u%c", &exec_tmout, &suffix) < 1 ||
-          optarg[0] == '-')
+      /* Milliseconds, with a fraction if need be (-t 0.5 is 500 us). */
+
+      tmout_ms = strtod(optarg, (char **)&suffix);
+
+      if (suffix == (u8 *)optarg || optarg[0] == '-' ||
+          (*suffix && strcmp((char *)suffix, "+")))
         FATAL("Bad syntax used for -t");
 
-      if (exec_tmout < 5)
+      exec_tmout_us = tmout_ms * 1000;
+      exec_tmout = (exec_tmout_us + 999) / 1000;
+
+      if (exec_tmout_us < 100)
         FATAL("Dangerously low value of -t");
 
-      if (suffix == '+')
+      if (*suffix == '+')
         timeout_given = 2;
       else
         timeout_given = 1;
@@ -9070,6 +12585,17 @@ int main(int argc, char **argv)
       break;
     }
 
+    case 'j': /* executors */
+
+      if (exec_cnt > 1)
+        FATAL("Multiple -j options not supported");
+
+      if (sscanf(optarg, "%u", &exec_cnt) < 1 || optarg[0] == '-' ||
+          !exec_cnt || exec_cnt > MAX_EXECUTORS)
+        FATAL("Bad syntax used for -j");
+
+      break;
+
     case 'd': /* skip deterministic */
 
       if (skip_deterministic)
@@ -9171,6 +12697,42 @@ int main(int argc, char **argv)
     no_cpu_meter_red = 1;
   if (getenv("AFL_NO_ARITH"))
     no_arith = 1;
+  if (getenv("AFL_HEAP_SCHED"))
+    heap_sched = 1;
+  if (getenv("AFL_ADAPTIVE_TMOUT"))
+    adaptive_tmout = 1;
+  if (getenv("AFL_MEMFD_INPUT") && out_file)
+    FATAL("AFL_MEMFD_INPUT and -f are mutually exclusive");
+
+  if (exec_cnt > 1)
+  {
+
+    if (dumb_mode || no_forkserver)
+      FATAL("-j needs the forkserver, so it doesn't go with -n or AFL_NO_FORKSRV");
+
+    execs = ck_alloc(exec_cnt * sizeof(struct executor));
+
+    for (i = 0; i < exec_cnt; i++)
+    {
+      execs[i].shm_id = execs[i].shm_fuzz_id = -1;
+      execs[i].cpu = -1;
+    }
+  }
+
+  /* Directors built with AFL_PDGF_SINK_EXIT stop as soon as they leave the
+     region for good; the runtime exits normally, so nothing else changes
+     on our side. */
+
+  if (!getenv("AFL_NO_SINK_EXIT"))
+    setenv(SINK_ENV_VAR, "1", 1);
+
+  /* With AFL_SNAPSHOT, the director's children roll themselves back and
+     stop after each run instead of exiting; to us, that looks just like
+     persistent mode. Persistent binaries keep their own loop. */
+
+  if (getenv("AFL_SNAPSHOT"))
+    setenv(SNAPSHOT_ENV_VAR, "1", 1);
+
   if (getenv("AFL_SHUFFLE_QUEUE"))
     shuffle_queue = 1;
   if (getenv("AFL_FAST_CAL"))
@@ -9183,6 +12745,30 @@ int main(int argc, char **argv)
       FATAL("Invalid value of AFL_HANG_TMOUT");
   }
 
+  if (getenv("AFL_NAV_STOP_BUDGET"))
+  {
+    nav_stop_budget = atoi(getenv("AFL_NAV_STOP_BUDGET"));
+    if (!nav_stop_budget)
+      FATAL("Invalid value of AFL_NAV_STOP_BUDGET");
+  }
+
+  if (getenv("AFL_NAV_PATCH_BUDGET"))
+  {
+    nav_patch_budget = atoi(getenv("AFL_NAV_PATCH_BUDGET"));
+    if (!nav_patch_budget)
+      FATAL("Invalid value of AFL_NAV_PATCH_BUDGET");
+  }
+
+  if (getenv("AFL_NAV_TMOUT"))
+  {
+    nav_tmout = atoi(getenv("AFL_NAV_TMOUT"));
+    if (!nav_tmout)
+      FATAL("Invalid value of AFL_NAV_TMOUT");
+  }
+
+  if (getenv("AFL_NAV_EXT_GRACE"))
+    nav_ext_grace = atoi(getenv("AFL_NAV_EXT_GRACE"));
+
   if (dumb_mode == 2 && no_forkserver)
     FATAL("AFL_DUMB_FORKSRV and AFL_NO_FORKSRV are mutually exclusive");
 
@@ -9211,7 +12797,6 @@ int main(int argc, char **argv)
   check_cpu_governor();
 
   setup_post();
-  setup_shm();
   init_count_class16();
 
   setup_dirs_fds();
@@ -9233,14 +12818,37 @@ int main(int argc, char **argv)
 
   check_binary(argv[optind]);
 
+  /* A persistent director is worth keeping alive through region changes. */
+
+  if (persistent_mode && !dumb_mode && !no_forkserver)
+    nav_live = 1;
+
+  map_size = read_map_layout(target_path);
+
+  if (map_size != MAP_SIZE)
+    OKF("Target uses a compact map of %u bytes.", map_size);
+
+  setup_shm();
+  setup_map_kernels();
+
   start_time = get_cur_time();
 
   setup_args(argc, argv);
 
+  setup_executors();
+
   setup_two_binary();
 
+  for (i = 0; i < nav_obj_cnt; i++)
+    load_target_names(nav_objs[i].checker_path);
+
+  if (targets_total)
+    OKF("Tracking %u target%s.", targets_total, targets_total > 1 ? "s" : "");
+
   modify_two_binary();
 
+  setup_region_log();
+
   perform_dry_run(director_argv);
 
   cull_queue();
@@ -9276,16 +12884,11 @@ int main(int argc, char **argv)
     {
 
       queue_cycle++;
-      current_entry = 0;
+      current_entry = heap_sched ? sched_heap[0] : seek_to;
       cur_skipped_paths = 0;
-      queue_cur = queue;
-
-      while (seek_to)
-      {
-        current_entry++;
-        seek_to--;
-        queue_cur = queue_cur->next;
-      }
+      queue_cur = queue_buf[current_entry];
+      seek_to = 0;
+      cycle_picks = 0;
 
       show_stats();
 
@@ -9324,14 +12927,31 @@ int main(int argc, char **argv)
         sync_fuzzers(director_argv);
     }
 
+    if (!stop_soon)
+      maintain_region(director_argv);
+
     if (!stop_soon && exit_1)
       stop_soon = 2;
 
     if (stop_soon)
       break;
 
-    queue_cur = queue_cur->next;
+    /* With the heap scheduler, a cycle is as many picks as there are
+       entries, so that cycle-based heuristics keep their pace. */
+
+    if (heap_sched)
+    {
+
+      q_fuzz_cnt[current_entry]++;
+      sched_update(current_entry);
+
+      current_entry = sched_heap[0];
+      queue_cur = ++cycle_picks < queued_paths ? queue_buf[current_entry] : NULL;
+      continue;
+    }
+
     current_entry++;
+    queue_cur = current_entry < queued_paths ? queue_buf[current_entry] : NULL;
   }
 
   if (queue_cur)
@@ -9339,19 +12959,28 @@ int main(int argc, char **argv)
 
   /* If we stopped programmatically, we kill the forkserver and the current runner.
      If we stopped manually, this is done by the signal handler. */
-  if (stop_soon == 2)
-  {
-    if (child_pid > 0)
-      kill(child_pid, SIGKILL);
-    if (forksrv_pid > 0)
-      kill(forksrv_pid, SIGKILL);
-  }
-  /* Now that we've killed the forkserver, we wait for it to be able to get rusage stats. */
-  if (waitpid(forksrv_pid, NULL, 0) <= 0)
+  for (i = 0; i < exec_cnt; i++)
   {
-    WARNF("error waitpid\n");
+
+    select_executor(i);
+
+    if (stop_soon == 2)
+    {
+      if (child_pid > 0)
+        kill(child_pid, SIGKILL);
+      if (forksrv_pid > 0)
+        kill(forksrv_pid, SIGKILL);
+    }
+
+    /* Now that we've killed the forkserver, we wait for it to be able to get rusage stats. */
+    if (forksrv_pid > 0 && waitpid(forksrv_pid, NULL, 0) <= 0)
+    {
+      WARNF("error waitpid\n");
+    }
   }
 
+  stop_nav_forkserver();
+
   write_bitmap();
   write_stats_file(0, 0, 0);
   save_auto();
@@ -36,6 +36,7 @@
 #include "debug.h"
 #include "alloc-inl.h"
 #include "hash.h"
+#include "layout-inl.h"
 
 #include <stdio.h>
 #include <unistd.h>
@@ -63,7 +64,8 @@ static u8 *out_file,                  /* Trace output file                 */
           *target_path,               /* Path to target binary             */
           *at_file;                   /* Substitution string for @@        */
 
-static u32 exec_tmout;                /* Exec timeout (ms)                 */
+static u32 exec_tmout,                /* Exec timeout (ms)                 */
+           map_size = MAP_SIZE;       /* Map size of the target binary     */
 
 static u64 mem_limit = MEM_LIMIT;     /* Memory limit (MB)                 */
 
@@ -149,7 +151,10 @@ static void setup_shm(void) {
 
   u8* shm_str;
 
-  shm_id = shmget(IPC_PRIVATE, MAP_SIZE, IPC_CREAT | IPC_EXCL | 0600);
+  /* Leave room for the target bytes the PDGF pass puts after the map. */
+
+  shm_id = shmget(IPC_PRIVATE, MAP_SIZE + PDGF_MAX_TARGETS,
+                  IPC_CREAT | IPC_EXCL | 0600);
 
   if (shm_id < 0) PFATAL("shmget() failed");
 
@@ -336,6 +341,11 @@ static void run_target(char** argv) {
   if (*(u32*)trace_bits == EXEC_FAIL_SIG)
     FATAL("Unable to execute '%s'", argv[0]);
 
+  /* With a compact map, the target bytes come right after it. They aren't
+     coverage, so leave them out. */
+
+  memset(trace_bits + map_size, 0, MAP_SIZE - map_size);
+
   classify_counts(trace_bits, binary_mode ?
                   count_class_binary : count_class_human);
 
@@ -766,6 +776,8 @@ int main(int argc, char** argv) {
 
   find_binary(argv[optind]);
 
+  map_size = read_map_layout(target_path);
+
   if (!quiet_mode) {
     show_banner();
     ACTF("Executing '%s'...\n", target_path);
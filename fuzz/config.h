@@ -71,6 +71,10 @@
 
 #define MEM_LIMIT_QEMU      200
 
+/* Maximum number of executors the director can be run as (-j): */
+
+#define MAX_EXECUTORS       64
+
 /* Number of calibration cycles per every new test case (and for test
    cases that show variable behavior): */
 
@@ -130,6 +134,11 @@
 #define SKIP_NFAV_OLD_PROB  95 /* ...no new favs, cur entry already fuzzed */
 #define SKIP_NFAV_NEW_PROB  75 /* ...no new favs, cur entry not fuzzed yet */
 
+/* With AFL_HEAP_SCHED, the recency bonus of an entry halves once this many
+   newer paths have been queued: */
+
+#define HEAP_RECENT_PATHS   32
+
 /* Splicing cycle count: */
 
 #define SPLICE_CYCLES       15
@@ -162,6 +171,11 @@
 #define TMIN_SET_MIN_SIZE   4
 #define TMIN_SET_STEPS      128
 
+/* Most writable memory, in MB, that the director may have mapped for the
+   snapshot engine (AFL_SNAPSHOT) to take it on; bigger ones fork as usual: */
+
+#define SNAPSHOT_MAX_MB     1024
+
 /* Maximum dictionary token size (-x), in bytes: */
 
 #define MAX_DICT_FILE       128
@@ -278,12 +292,20 @@
 
 #define SHM_ENV_VAR         "__AFL_SHM_ID"
 
+/* Environment variable used to pass the ID of the testcase SHM region
+   (a 32-bit length followed by up to MAX_FILE bytes of data): */
+
+#define SHM_FUZZ_ENV_VAR    "__AFL_SHM_FUZZ_ID"
+
 /* Other less interesting, internal-only variables. */
 
 #define CLANG_ENV_VAR       "__AFL_CLANG_MODE"
 #define AS_LOOP_ENV_VAR     "__AFL_AS_LOOPCHECK"
 #define PERSIST_ENV_VAR     "__AFL_PERSISTENT"
 #define DEFER_ENV_VAR       "__AFL_DEFER_FORKSRV"
+#define NAV_FORKSRV_ENV_VAR "__AFL_NAV_FORKSRV"
+#define SINK_ENV_VAR        "__AFL_SINK_EXIT"
+#define SNAPSHOT_ENV_VAR    "__AFL_SNAPSHOT"
 
 /* In-code signatures for deferred and persistent mode. */
 
@@ -303,6 +325,55 @@
 
 #define FORKSRV_FD          198
 
+/* With AFL_MEMFD_INPUT, the @@ file is a memfd kept open at this descriptor
+   and handed to the target as /proc/self/fd/<fd>: */
+
+#define MEMFD_INPUT_FD      (FORKSRV_FD - 1)
+
+/* "Hello" message sent by a checker binary started as the navigator's
+   forkserver, telling afl-fuzz that it will hold each new child until the
+   navigator has attached to it: */
+
+#define NAV_FORKSRV_HELLO   0x3156414e
+
+/* Marker table emitted by the LLVM pass. Each record is three 32-bit words:
+   the marker address relative to the record, the block's cur_loc, and
+   flags (PDGF_SITE_REGION for blocks in the precondition region). With
+   PDGF_SITE_EXACT, the block leaves the value in the top 16 bits of the
+   flags in prev_loc instead of cur_loc >> 1: */
+
+#define PDGF_SITES_SECTION  "__pdgf_sites"
+#define PDGF_SITE_SIZE      12
+#define PDGF_SITE_REGION    1
+#define PDGF_SITE_EXACT     2
+
+/* Map layout record emitted by the LLVM pass, one 32-bit map size per
+   module. With AFL_PDGF_COMPACT_MAP, the region slice (a quarter of the map)
+   gets PDGF_COMPACT_SLACK slots per region block, rounded up to a power of
+   two, and the map is kept between 2^PDGF_MIN_MAP_POW2 and MAP_SIZE: */
+
+#define PDGF_LAYOUT_SECTION "__pdgf_layout"
+#define PDGF_COMPACT_SLACK  4
+#define PDGF_MIN_MAP_POW2   10
+
+/* Set in the forkserver hello when the low bits carry the map size the
+   binary was built for: */
+
+#define FORKSRV_MAP_HELLO   0x80000000
+
+/* Also set in that hello when the target takes its testcases from the
+   SHM_FUZZ_ENV_VAR region instead of stdin or a file: */
+
+#define FORKSRV_SHM_FUZZ    0x40000000
+
+/* Target lines (the ones given to cbi) get a byte each right after the
+   coverage map, set whenever the line is reached. Each module the pass sees
+   a target in also records "<id as a 32-bit word><file:line>\0", padded to
+   four bytes, in PDGF_TARGETS_SECTION: */
+
+#define PDGF_MAX_TARGETS    64
+#define PDGF_TARGETS_SECTION "__pdgf_targets"
+
 /* Fork server init timeout multiplier: we'll wait the user-selected
    timeout plus this much for the fork server to spin up. */
 
@@ -315,10 +386,43 @@
 #define CAL_TMOUT_PERC      125
 #define CAL_TMOUT_ADD       50
 
+/* Adaptive timeouts (AFL_ADAPTIVE_TMOUT): each entry is fuzzed with this
+   many times the larger of its own exec time and the given percentile of
+   exec times across the queue, but no less than the floor (in us) and never
+   more than -t: */
+
+#define ADAPT_TMOUT_PERC    95
+#define ADAPT_TMOUT_MULT    4
+#define ADAPT_TMOUT_MIN_US  500
+
 /* Number of chances to calibrate a case before giving up: */
 
 #define CAL_CHANCES         3
 
+/* Limits for a single navigator (checker) run. The stop budget caps the
+   number of marker traps handled, the patch budget caps the number of sites
+   moved into the region, and the timeout is a multiple of the exec timeout,
+   since every traced block costs a round-trip through ptrace: */
+
+#define NAV_STOP_BUDGET     30000
+#define NAV_PATCH_BUDGET    30000
+#define NAV_TMOUT_MULT      20
+
+/* How far past a marker to look for the block ID immediates: */
+
+#define NAV_ID_WINDOW       80
+
+/* Initial slot count for the navigator's site sets (power of two): */
+
+#define NAV_SET_INIT        1024
+
+/* Region maintenance: how often to look for extensions that never led to
+   new region coverage (seconds), and how many execs an extension gets before
+   it can be retired (AFL_NAV_EXT_GRACE, 0 disables retiring): */
+
+#define NAV_MAINT_INTERVAL  600
+#define NAV_EXT_GRACE       2000000
+
 /* Map size for the traced binary (2^MAP_SIZE_POW2). Must be greater than
    2; you probably want to keep it under 18 or so for performance reasons
    (adjusting AFL_INST_RATIO when compiling is probably a better way to solve
@@ -0,0 +1,82 @@
+/*
+   PDGF - map layout of instrumented binaries
+   ------------------------------------------
+
+   The LLVM pass records the map size each module was built for in
+   PDGF_LAYOUT_SECTION. afl-fuzz and the helper tools read it from there,
+   so that they know where coverage ends and the target bytes begin.
+*/
+
+#ifndef _HAVE_LAYOUT_INL_H
+#define _HAVE_LAYOUT_INL_H
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+
+#include <sys/mman.h>
+
+#include "config.h"
+#include "types.h"
+#include "debug.h"
+
+/* Read the map size an instrumented object was built for from its layout
+   record. Objects without one use the classic MAP_SIZE layout; every module
+   linked into an object must agree on the size. */
+
+static u32 read_map_layout(u8* path) {
+
+  Elf64_Ehdr* ehdr;
+  Elf64_Shdr *shdr, *tab = NULL;
+  u8 *fdata, *names;
+  u32 i, n, size = MAP_SIZE;
+  s32 fd;
+  off_t fsize;
+
+  fd = open((char*)path, O_RDONLY);
+  if (fd < 0) PFATAL("Unable to open '%s'", path);
+
+  fsize = lseek(fd, 0, SEEK_END);
+  fdata = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  if (fdata == MAP_FAILED) PFATAL("mmap() failed on '%s'", path);
+
+  close(fd);
+
+  ehdr = (Elf64_Ehdr*)fdata;
+
+  if (fsize < sizeof(Elf64_Ehdr) || memcmp(fdata, ELFMAG, SELFMAG) ||
+      fdata[EI_CLASS] != ELFCLASS64) {
+    munmap(fdata, fsize);
+    return MAP_SIZE;
+  }
+
+  shdr  = (Elf64_Shdr*)(fdata + ehdr->e_shoff);
+  names = fdata + shdr[ehdr->e_shstrndx].sh_offset;
+
+  for (i = 0; i < ehdr->e_shnum; i++)
+    if (!strcmp((char*)names + shdr[i].sh_name, PDGF_LAYOUT_SECTION))
+      tab = &shdr[i];
+
+  if (tab && tab->sh_type != SHT_NOBITS && tab->sh_size >= 4) {
+
+    n    = tab->sh_size / 4;
+    size = *(u32*)(fdata + tab->sh_offset);
+
+    for (i = 1; i < n; i++)
+      if (*(u32*)(fdata + tab->sh_offset + i * 4) != size)
+        FATAL("Modules of '%s' were built with different map sizes", path);
+
+  }
+
+  munmap(fdata, fsize);
+
+  if (size < (1 << PDGF_MIN_MAP_POW2) || size > MAP_SIZE || (size & (size - 1)))
+    FATAL("Bogus map size %u in '%s'", size, path);
+
+  return size;
+
+}
+
+#endif /* !_HAVE_LAYOUT_INL_H */
@@ -272,6 +272,26 @@ static void edit_params(u32 argc, char** argv) {
 #endif /* ^__APPLE__ */
     "_I(); } while (0)";
 
+  /* Harnesses that take their input from __AFL_FUZZ_TESTCASE_BUF and
+     __AFL_FUZZ_TESTCASE_LEN get it straight from afl-fuzz's SHM region. When
+     the binary runs outside of afl-fuzz, the input is read from stdin into a
+     buffer of our own instead. __AFL_FUZZ_INIT() goes at file scope, in the
+     same file as the other two. */
+
+  cc_params[cc_par_cnt++] = alloc_printf("-D__AFL_FUZZ_INIT()="
+    "int __afl_sharedmem_fuzzing = 1; "
+    "extern unsigned int *__afl_fuzz_len; "
+    "extern unsigned char *__afl_fuzz_ptr; "
+    "unsigned char __afl_fuzz_alt[%u];", MAX_FILE);
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_BUF="
+    "(__afl_fuzz_ptr ? __afl_fuzz_ptr : __afl_fuzz_alt)";
+
+  cc_params[cc_par_cnt++] = "-D__AFL_FUZZ_TESTCASE_LEN="
+    "(__afl_fuzz_ptr ? *__afl_fuzz_len : "
+    "(*__afl_fuzz_len = read(0, __afl_fuzz_alt, sizeof(__afl_fuzz_alt))) == "
+    "0xffffffff ? 0 : *__afl_fuzz_len)";
+
   if (x_set) {
     cc_params[cc_par_cnt++] = "-x";
     cc_params[cc_par_cnt++] = "none";
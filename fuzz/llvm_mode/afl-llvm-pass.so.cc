@@ -43,6 +43,7 @@
 #include <string>
 #include <sstream>
 #include <list>
+#include <set>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -61,6 +62,7 @@
 #include "llvm/Analysis/CFGPrinter.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/InlineAsm.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Pass.h"
 
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
@@ -161,6 +163,33 @@ static bool isBlacklisted(const Function *F)
   return false;
 }
 
+/* Quote a string for an .asciz directive: backslashes, quotes and anything
+   unprintable go out as escapes. */
+
+static std::string asmEscape(const std::string &Str)
+{
+  std::string Out;
+  char Oct[8];
+
+  for (unsigned char Ch : Str)
+  {
+    if (Ch == '"' || Ch == '\\')
+    {
+      Out += '\\';
+      Out += Ch;
+    }
+    else if (Ch < 0x20 || Ch >= 0x7f)
+    {
+      snprintf(Oct, sizeof(Oct), "\\%03o", Ch);
+      Out += Oct;
+    }
+    else
+      Out += Ch;
+  }
+
+  return Out;
+}
+
 bool AFLCoverage::runOnModule(Module &M)
 {
 
@@ -243,6 +272,242 @@ bool AFLCoverage::runOnModule(Module &M)
   }
   targetsfile.close();
 
+  /* The target lines given to cbi, "file:line" each. Lines without a ':'
+     are skipped; the position of a target among the others is its slot
+     after the map. */
+
+  std::vector<std::pair<std::string, unsigned int>> targets;
+  std::ifstream tfile(OutDirectory + "/targets");
+
+  while (std::getline(tfile, lines))
+  {
+
+    std::size_t colon = lines.rfind(':');
+
+    if (colon == std::string::npos)
+      continue;
+
+    if (targets.size() == PDGF_MAX_TARGETS)
+    {
+      WARNF("Only the first %u targets get a target slot.", PDGF_MAX_TARGETS);
+      break;
+    }
+
+    targets.push_back(std::make_pair(lines.substr(0, colon),
+                                     (unsigned int)atoi(lines.c_str() + colon + 1)));
+  }
+
+  std::vector<bool> target_seen(targets.size());
+  int target_sites = 0;
+
+  /* With AFL_PDGF_SINK_EXIT, the non-region blocks cbi found to have no way
+     back into the region (sink_blocks.txt) let the director exit right after
+     recording their coverage. The checks go in once all blocks have been
+     instrumented, since they split the block. */
+
+  std::set<std::string> sink_blocks;
+  std::vector<Instruction *> sink_points;
+
+  if (getenv("AFL_PDGF_SINK_EXIT"))
+  {
+
+    std::ifstream sinkfile(OutDirectory + "/sink_blocks.txt");
+
+    if (!hasfile || !sinkfile)
+      WARNF("AFL_PDGF_SINK_EXIT needs premake_results.txt and sink_blocks.txt.");
+
+    while (std::getline(sinkfile, lines))
+      sink_blocks.insert(lines);
+  }
+
+  /* With AFL_PDGF_EXACT_REGION, read the region edges found by cbi: pairs of
+     indices into premake_results.txt. */
+
+  std::vector<std::pair<unsigned int, unsigned int>> region_edges;
+  int exact_region = 0;
+
+  if (getenv("AFL_PDGF_EXACT_REGION"))
+  {
+
+    std::ifstream edgesfile(OutDirectory + "/region_edges.txt");
+    unsigned int src, dst;
+
+    if (!hasfile || !edgesfile)
+      WARNF("AFL_PDGF_EXACT_REGION needs premake_results.txt and region_edges.txt.");
+    else
+    {
+
+      while (edgesfile >> src >> dst)
+        if (src < basic_blocks.size() && dst < basic_blocks.size())
+          region_edges.push_back(std::make_pair(src, dst));
+
+      exact_region = 1;
+    }
+  }
+
+  /* Pick the map layout: region blocks get IDs from the bottom quarter of
+     the map, the rest from the top one. With AFL_PDGF_COMPACT_MAP, the map
+     shrinks to what the region needs; every module reads the same
+     premake_results.txt, so they all come up with the same size. afl-fuzz
+     reads it back from the layout record. */
+
+  unsigned int map_size = MAP_SIZE;
+
+  if (getenv("AFL_PDGF_COMPACT_MAP"))
+  {
+
+    if (!hasfile)
+      WARNF("AFL_PDGF_COMPACT_MAP needs premake_results.txt, using the full map.");
+    else
+    {
+
+      unsigned long want = std::max(basic_blocks.size(), region_edges.size()) *
+                           PDGF_COMPACT_SLACK;
+
+      map_size = 1 << PDGF_MIN_MAP_POW2;
+      while ((map_size >> 2) < want && map_size < MAP_SIZE)
+        map_size <<= 1;
+    }
+  }
+
+  unsigned int region_size = map_size >> 2;
+
+  /* Exact region IDs, the way CollAFL does it: region block i (its line in
+     premake_results.txt) leaves i in prev_loc, and its cur_loc is picked so
+     that cur_loc ^ prev for every edge cbi found into it lands on a slot no
+     other region edge uses. The inputs are the same for every module and so
+     is the greedy walk, so all modules agree without seeing each other.
+     Blocks we can't place keep a random cur_loc, and so may collide. */
+
+  std::vector<int> exact_cur;
+
+  if (exact_region && basic_blocks.size() > region_size)
+  {
+    WARNF("%lu region blocks don't fit a %u-entry region slice, IDs stay random.",
+          (unsigned long)basic_blocks.size(), region_size);
+    exact_region = 0;
+  }
+
+  if (exact_region)
+  {
+
+    std::vector<std::vector<unsigned int>> preds(basic_blocks.size());
+    std::vector<bool> used(region_size);
+    unsigned int placed = 0;
+
+    for (auto &e : region_edges)
+      preds[e.second].push_back(e.first);
+
+    exact_cur.assign(basic_blocks.size(), -1);
+
+    for (unsigned int i = 0; i < basic_blocks.size(); i++)
+    {
+
+      unsigned int start = (i * 2654435761u) & (region_size - 1), t, j;
+
+      for (t = 0; t < region_size; t++)
+      {
+
+        unsigned int c = (start + t) & (region_size - 1);
+
+        for (j = 0; j < preds[i].size(); j++)
+          if (used[c ^ preds[i][j]])
+            break;
+
+        if (j == preds[i].size())
+        {
+          for (j = 0; j < preds[i].size(); j++)
+            used[c ^ preds[i][j]] = true;
+          exact_cur[i] = c;
+          placed++;
+          break;
+        }
+      }
+    }
+
+    if (placed < basic_blocks.size())
+      WARNF("%lu region blocks got no collision-free ID.",
+            (unsigned long)(basic_blocks.size() - placed));
+  }
+
+  /* With AFL_PDGF_AUTO_DEFER, start the forkserver where cbi says it's safe
+     (deferred_init.txt, "file,line" in main): before the first instruction
+     of main on that line, going by the location in main itself for code
+     inlined into it. The signature tells afl-fuzz to expect it. */
+
+  Function *MainF = M.getFunction("main");
+
+  if (getenv("AFL_PDGF_AUTO_DEFER") && MainF && !MainF->isDeclaration())
+  {
+
+    std::ifstream deferfile(OutDirectory + "/deferred_init.txt");
+    std::string want;
+    Instruction *InitPt = nullptr;
+
+    if (!std::getline(deferfile, want) || want.empty())
+      WARNF("AFL_PDGF_AUTO_DEFER needs deferred_init.txt from cbi.");
+
+    for (auto &BB : *MainF)
+    {
+
+      for (auto &I : BB)
+      {
+
+        if (want.empty() || isa<PHINode>(I) || isa<AllocaInst>(I) || I.isEHPad())
+          continue;
+
+        DILocation *Loc = I.getDebugLoc();
+
+        while (Loc && Loc->getInlinedAt())
+          Loc = Loc->getInlinedAt();
+
+        if (!Loc || !Loc->getLine())
+          continue;
+
+        std::string file = Loc->getFilename().str();
+        std::size_t found = file.find_last_of("/\\");
+
+        if (found != std::string::npos)
+          file = file.substr(found + 1);
+
+        if (file + "," + std::to_string(Loc->getLine()) == want)
+        {
+          InitPt = &I;
+          break;
+        }
+      }
+
+      if (InitPt)
+        break;
+    }
+
+    if (InitPt)
+    {
+
+      IRBuilder<> DRB(InitPt);
+
+      /* Same trick as __AFL_INIT(): a volatile store keeps the signature
+         from being optimized or garbage-collected away. */
+
+      GlobalVariable *SigPtr = new GlobalVariable(
+          M, PointerType::get(Int8Ty, 0), false, GlobalValue::InternalLinkage,
+          ConstantPointerNull::get(PointerType::get(Int8Ty, 0)), "__pdgf_defer_sig");
+
+      DRB.CreateStore(DRB.CreateGlobalStringPtr(DEFER_SIG), SigPtr, true);
+      DRB.CreateCall(M.getOrInsertFunction("__afl_manual_init",
+                                           FunctionType::get(Type::getVoidTy(C), false)));
+
+      OKF("Deferred forkserver start at %s in main.", want.c_str());
+    }
+    else if (!want.empty())
+      WARNF("Line %s not found in main, forkserver not deferred.", want.c_str());
+  }
+
+  M.appendModuleInlineAsm(".pushsection " PDGF_LAYOUT_SECTION ",\"a\",@progbits\n"
+                          ".balign 4\n"
+                          ".long " + std::to_string(map_size) + "\n"
+                          ".popsection");
+
   for (auto &F : M)
   {
     int firstbb = 1;
@@ -250,6 +515,7 @@ bool AFLCoverage::runOnModule(Module &M)
     for (auto &BB : F)
     {
       bool is_pre = false;
+      int bb_index = -1;
 
       std::string filename;
       unsigned line;
@@ -275,56 +541,139 @@ bool AFLCoverage::runOnModule(Module &M)
           if (it != basic_blocks.end())
           {
             is_pre = true;
+            bb_index = it - basic_blocks.begin();
           }
 
           break;
         }
       }
 
+      /* Set the slot of every target line in the block, right before its
+         first instruction. File names match like in cbi: the target may
+         leave out leading directories. */
+
+      std::vector<std::pair<Instruction *, unsigned int>> target_hits;
+
+      for (auto &I : BB)
+      {
+
+        std::string tfilename;
+        unsigned tline = 0;
+
+        if (targets.empty() || isa<PHINode>(I) || I.isEHPad())
+          continue;
+
+        getDebugLoc(&I, tfilename, tline);
+
+        for (unsigned int t = 0; t < targets.size(); t++)
+        {
+
+          std::size_t idx = tfilename.find(targets[t].first);
+
+          if (tline != targets[t].second || idx == std::string::npos ||
+              (idx && tfilename[idx - 1] != '/'))
+            continue;
+
+          bool dup = false;
+
+          for (auto &h : target_hits)
+            if (h.second == t)
+              dup = true;
+
+          if (!dup)
+            target_hits.push_back(std::make_pair(&I, t));
+        }
+      }
+
+      for (auto &h : target_hits)
+      {
+
+        IRBuilder<> TRB(h.first);
+
+        LoadInst *TMapPtr = TRB.CreateLoad(AFLMapPtr);
+        TMapPtr->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+        Value *TSlot = TRB.CreateGEP(TMapPtr, ConstantInt::get(Int32Ty, map_size + h.second));
+        TRB.CreateStore(ConstantInt::get(Int8Ty, 1), TSlot)
+            ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+        if (!target_seen[h.second])
+        {
+
+          std::string name = targets[h.second].first + ":" + std::to_string(targets[h.second].second);
+
+          M.appendModuleInlineAsm(".pushsection " PDGF_TARGETS_SECTION ",\"a\",@progbits\n"
+                                  ".balign 4\n"
+                                  ".long " + std::to_string(h.second) + "\n"
+                                  ".asciz \"" + asmEscape(name) + "\"\n"
+                                  ".balign 4\n"
+                                  ".popsection");
+          target_seen[h.second] = true;
+        }
+
+        target_sites++;
+      }
+
       BasicBlock::iterator IP = BB.getFirstInsertionPt();
       IRBuilder<> IRB(&(*IP));
 
-      StringRef asmString = "jmp .+2";
       StringRef constraints = "~{dirflag},~{fpsr},~{flags}";
       FunctionType *FTy = FunctionType::get(Type::getVoidTy(*Ctx), false);
-      llvm::InlineAsm *IA = llvm::InlineAsm::get(FTy, asmString, constraints, true, false, InlineAsm::AD_ATT);
-      ArrayRef<Value *> Args = None;
-      llvm::CallInst *Ptr_1 = IRB.CreateCall(IA, Args);
-      Ptr_1->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+
+      /* Blocks left out by AFL_INST_RATIO still get the bare marker. */
 
       if (AFL_R(100) >= inst_ratio)
-        continue;
-      if (hasfile && !is_pre)
       {
+        llvm::InlineAsm *IA = llvm::InlineAsm::get(FTy, "jmp .+2", constraints, true, false, InlineAsm::AD_ATT);
+        llvm::CallInst *Ptr_1 = IRB.CreateCall(IA, None);
+        Ptr_1->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+        continue;
+      }
 
-        StringRef asmString_nop = "nop";
-        StringRef constraints_nop = "~{dirflag},~{fpsr},~{flags}";
-        FunctionType *FTy_nop = FunctionType::get(Type::getVoidTy(*Ctx), false);
-        llvm::InlineAsm *IA_nop = llvm::InlineAsm::get(FTy_nop, asmString_nop, constraints_nop, true, false, InlineAsm::AD_ATT);
-        ArrayRef<Value *> Args_nop = None;
-        llvm::CallInst *Ptr_2 = IRB.CreateCall(IA_nop, Args_nop);
-        Ptr_2->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+      bool is_region = !hasfile || is_pre;
 
-        none_pre_bb_num++;
-      }
+      if (is_region)
+        pre_bb_num++;
       else
+        none_pre_bb_num++;
+
+      /* Make up cur_loc */
+
+      unsigned int cur_loc = AFL_R(region_size);
+      if (!is_region)
+        cur_loc = cur_loc + 3 * region_size;
+
+      unsigned int prev_val = cur_loc >> 1,
+                   site_flags = is_region ? PDGF_SITE_REGION : 0;
+
+      if (exact_region && is_pre && exact_cur[bb_index] >= 0)
       {
-        pre_bb_num++;
+        cur_loc = exact_cur[bb_index];
+        prev_val = bb_index;
+        site_flags |= PDGF_SITE_EXACT | (prev_val << 16);
       }
 
-      StringRef asmString_nop = "nop";
-      StringRef constraints_nop = "~{dirflag},~{fpsr},~{flags}";
-      FunctionType *FTy_nop = FunctionType::get(Type::getVoidTy(*Ctx), false);
-      llvm::InlineAsm *IA_nop = llvm::InlineAsm::get(FTy_nop, asmString_nop, constraints_nop, true, false, InlineAsm::AD_ATT);
-      ArrayRef<Value *> Args_nop = None;
-      llvm::CallInst *Ptr_2 = IRB.CreateCall(IA_nop, Args_nop);
-      Ptr_2->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
+      /* Emit the marker (jmp .+2, then one nop for region blocks and two
+         for the rest) together with its record in the marker table, so
+         that afl-fuzz doesn't have to scan .text to find it. The record
+         holds the marker address relative to itself, which needs no
+         relocation in PIE or shared objects. */
 
-      /* Make up cur_loc */
+      std::string marker = "1: jmp .+2\n\tnop\n";
 
-      unsigned int cur_loc = AFL_R(MAP_SIZE >> 2);
-      if (hasfile && !is_pre)
-        cur_loc = cur_loc + (unsigned int)49152;
+      if (!is_region)
+        marker += "\tnop\n";
+
+      marker += "\t.pushsection " PDGF_SITES_SECTION ",\"a\",@progbits\n"
+                "\t.balign 4\n"
+                "\t.long 1b - .\n"
+                "\t.long " + std::to_string(cur_loc) + "\n"
+                "\t.long " + std::to_string(site_flags) + "\n"
+                "\t.popsection";
+
+      llvm::InlineAsm *IA = llvm::InlineAsm::get(FTy, marker, constraints, true, false, InlineAsm::AD_ATT);
+      llvm::CallInst *Ptr_1 = IRB.CreateCall(IA, None);
+      Ptr_1->addAttribute(AttributeList::FunctionIndex, Attribute::NoUnwind);
 
       ConstantInt *CurLoc = ConstantInt::get(Int32Ty, cur_loc);
 
@@ -349,17 +698,62 @@ bool AFLCoverage::runOnModule(Module &M)
       IRB.CreateStore(Incr, MapPtrIdx)
           ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
-      /* Set prev_loc to cur_loc >> 1 */
+      /* Set prev_loc to cur_loc >> 1 (or the block's index, for exact IDs) */
 
       StoreInst *Store =
-          IRB.CreateStore(ConstantInt::get(Int32Ty, cur_loc >> 1), AFLPrevLoc);
+          IRB.CreateStore(ConstantInt::get(Int32Ty, prev_val), AFLPrevLoc);
       Store->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
 
+      if (!is_region && sink_blocks.count(bb_name))
+        sink_points.push_back(Store);
+
       inst_blocks++;
     }
   }
+  /* if (__afl_sink_armed && prev_loc >= region_size) __afl_sink_exit(); -
+     the runtime only arms it in the director's children. prev_loc is read
+     back rather than known: once afl-fuzz moves the block into the region,
+     the ID it stores there is a region one, and the block no longer exits.
+     That leaves sinks cbi got wrong to the navigator. */
+
+  if (!sink_points.empty())
+  {
+
+    GlobalVariable *SinkArmed = new GlobalVariable(
+        M, Int8Ty, false, GlobalValue::ExternalLinkage, 0, "__afl_sink_armed");
+    FunctionCallee SinkExit = M.getOrInsertFunction(
+        "__afl_sink_exit", FunctionType::get(Type::getVoidTy(C), false));
+
+    for (auto *P : sink_points)
+    {
+
+      Instruction *After = P->getNextNode();
+      IRBuilder<> SRB(After);
+
+      LoadInst *Armed = SRB.CreateLoad(SinkArmed);
+      Armed->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+      LoadInst *Loc = SRB.CreateLoad(AFLPrevLoc, true);
+      Loc->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+      Value *Sunk = SRB.CreateAnd(
+          SRB.CreateICmpNE(Armed, ConstantInt::get(Int8Ty, 0)),
+          SRB.CreateICmpUGE(Loc, ConstantInt::get(Int32Ty, region_size)));
+
+      Instruction *Then = SplitBlockAndInsertIfThen(Sunk, After, true);
+
+      IRBuilder<> TRB(Then);
+      TRB.CreateCall(SinkExit)->setDoesNotReturn();
+    }
+
+    OKF("Marked %u sink blocks.", (unsigned)sink_points.size());
+  }
+
   OKF("Instrumented as pre bbs: %d, none_pre bbs: %d \n", pre_bb_num, none_pre_bb_num);
 
+  if (target_sites)
+    OKF("Marked %d target sites.", target_sites);
+
   /* Say something nice. */
 
   if (!be_quiet)
@@ -368,8 +762,8 @@ bool AFLCoverage::runOnModule(Module &M)
     if (!inst_blocks)
       WARNF("No instrumentation targets found.");
     else
-      OKF("Instrumented %u locations (%s mode, ratio %u%%).",
-          inst_blocks, getenv("AFL_HARDEN") ? "hardened" : ((getenv("AFL_USE_ASAN") || getenv("AFL_USE_MSAN")) ? "ASAN/MSAN" : "non-hardened"), inst_ratio);
+      OKF("Instrumented %u locations (%s mode, ratio %u%%, %u-byte map).",
+          inst_blocks, getenv("AFL_HARDEN") ? "hardened" : ((getenv("AFL_USE_ASAN") || getenv("AFL_USE_MSAN")) ? "ASAN/MSAN" : "non-hardened"), inst_ratio, map_size);
   }
 
   return true;
@@ -42,6 +42,12 @@
 #include <sys/wait.h>
 #include <sys/types.h>
 
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <ucontext.h>
+#  include <sys/syscall.h>
+#endif /* __linux__ */
+
 /* This is a somewhat ugly hack for the experimental 'trace-pc-guard' mode.
    Basically, we need to make sure that the forkserver is initialized after
    the LLVM-generated runtime initialization pass, not before. */
@@ -57,17 +63,642 @@
    is used for instrumentation output before __afl_map_shm() has a chance to run.
    It will end up as .comm, so it shouldn't be too wasteful. */
 
-u8  __afl_area_initial[MAP_SIZE];
+u8  __afl_area_initial[MAP_SIZE + PDGF_MAX_TARGETS];
 u8* __afl_area_ptr = __afl_area_initial;
 
 __thread u32 __afl_prev_loc;
 
 
+/* Testcase delivery through SHM, used by __AFL_FUZZ_TESTCASE_BUF and
+   __AFL_FUZZ_TESTCASE_LEN. __AFL_FUZZ_INIT() overrides the weak flag, so only
+   harnesses written for it ask afl-fuzz for the region. Without one,
+   __afl_fuzz_ptr stays NULL and the macros read stdin instead. */
+
+int __afl_sharedmem_fuzzing __attribute__((weak));
+
+static u32 __afl_fuzz_len_dummy;
+
+u8*  __afl_fuzz_ptr;
+u32* __afl_fuzz_len = &__afl_fuzz_len_dummy;
+
+
+/* Map layout records left by the pass, one per module (PDGF_LAYOUT_SECTION
+   in config.h). The linker provides the bounds; binaries built before the
+   records existed don't have any. */
+
+extern u32 __start___pdgf_layout __attribute__((weak));
+extern u32 __stop___pdgf_layout __attribute__((weak));
+
+
+/* Map size the binary was built for. The SHM region we get is only that
+   large, so nothing past it may be touched. */
+
+static u32 __afl_map_size(void) {
+
+  if (&__start___pdgf_layout &&
+      &__start___pdgf_layout != &__stop___pdgf_layout)
+    return __start___pdgf_layout;
+
+  return MAP_SIZE;
+
+}
+
+
 /* Running in persistent mode? */
 
 static u8 is_persistent;
 
 
+/* Serving as the checker forkserver for the navigator? */
+
+static u8 is_nav;
+
+
+/* Taking a snapshot in each of the director's children? */
+
+static u8 snap_mode;
+
+
+/* Snapshot mode (AFL_SNAPSHOT). Rather than forking for every testcase, the
+   director's child takes a snapshot of itself right after the fork, runs the
+   testcase, rolls its memory back and stops with SIGSTOP, just like a
+   persistent-mode child does after each iteration. The forkserver then
+   wakes it up for the next testcase, and it carries on from the snapshot.
+
+   Only the pages the kernel flags as soft-dirty get copied back. Kernels
+   built without CONFIG_MEM_SOFT_DIRTY get no snapshots at all: copying
+   back every page after every run would cost more than the fork it saves
+   for the large heaps this is meant for. Mappings, file descriptors and
+   heap that appeared
+   during the run are dropped. Whenever that's not enough to get back to
+   the snapshot (a mapping we saved went away, or turned read-only), the
+   child simply exits, and the forkserver forks a fresh one next time.
+   Runs that crash, time out or _exit() behave just as they would without
+   snapshots. */
+
+#ifdef __linux__
+
+#define SNAP_MAX_MAPS   1024
+#define SNAP_MAX_FDS    1024
+#define SNAP_BUF_SIZE   (1024 * 1024)
+#define SNAP_STACK_SIZE (64 * 1024)
+
+#define PM_SOFT_DIRTY   (1ULL << 55)
+#define PM_SWAPPED      (1ULL << 62)
+#define PM_PRESENT      (1ULL << 63)
+
+struct snap_map {
+  u8* start;
+  u8* end;
+  u8  saved;                    /* Private & writable, so rolled back  */
+  u32* slot;                    /* Backup page per page, or ~0        */
+};
+
+struct linux_dirent64 {
+  u64 d_ino;
+  s64 d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char d_name[];
+};
+
+/* Everything the engine needs while it rolls back is kept in mappings of
+   its own. They are shared ones, so that the kernel never merges them with
+   the process' private memory, and they are never rolled back. */
+
+struct snap_engine {
+
+  ucontext_t snap_ctx;          /* Where each run starts from          */
+  ucontext_t end_ctx;           /* Rollback, on the stack below        */
+  u8  resumed;
+
+  s32 pid;
+  s32 pagemap_fd, clear_fd;
+  void* brk;
+
+  u32 map_cnt, cur_cnt;
+  struct snap_map maps[SNAP_MAX_MAPS];
+  struct snap_map cur[SNAP_MAX_MAPS];
+
+  u8* store;
+  u64 store_len;
+  u64 store_cap;                /* Room for pages, as counted          */
+  u8  store_over;               /* More pages than that at save time?  */
+
+  u8  fd_open[SNAP_MAX_FDS];     /* 1: at snapshot time, 2: right now  */
+  s64 fd_off[SNAP_MAX_FDS];
+  u8  fd_over;                  /* Descriptors past SNAP_MAX_FDS?     */
+
+  u8  buf[SNAP_BUF_SIZE];
+  u8  stack[SNAP_STACK_SIZE];
+
+};
+
+static struct snap_engine* snap;
+static u64 snap_page;
+
+
+/* Is this one of the engine's own mappings? */
+
+static u8 __afl_snap_own(u8* start) {
+
+  return start == (u8*)snap || (snap->store && start == snap->store);
+
+}
+
+
+/* Read /proc/self/maps into out[], dropping the kernel's own entries
+   ([vvar], [vdso], [vsyscall]). Returns the count, or -1. */
+
+static s32 __afl_snap_read_maps(struct snap_map* out) {
+
+  s32 fd = open("/proc/self/maps", O_RDONLY), cnt = 0;
+  u32 len = 0;
+  s32 n;
+  u8* p;
+
+  if (fd < 0) return -1;
+
+  while ((n = read(fd, snap->buf + len, SNAP_BUF_SIZE - 1 - len)) > 0)
+    len += n;
+
+  close(fd);
+
+  if (n < 0 || len == SNAP_BUF_SIZE - 1) return -1;
+  snap->buf[len] = 0;
+
+  p = snap->buf;
+
+  while (*p) {
+
+    u8 *eol = (u8*)strchr((char*)p, '\n'), *q;
+    u8 *start, *end, *perms, *path;
+    u32 field;
+
+    if (eol) *eol = 0;
+
+    start = (u8*)strtoull((char*)p, (char**)&q, 16);
+    end   = (u8*)strtoull((char*)q + 1, (char**)&q, 16);
+    perms = q + 1;
+
+    /* Skip perms, offset, dev and inode to get to the path. */
+
+    path = perms;
+    for (field = 0; field < 4; field++) {
+      while (*path && *path != ' ') path++;
+      while (*path == ' ') path++;
+    }
+
+    p = eol ? eol + 1 : p + strlen((char*)p);
+
+    if (!strncmp((char*)path, "[v", 2)) continue;
+
+    if (cnt == SNAP_MAX_MAPS) return -1;
+
+    out[cnt].start = start;
+    out[cnt].end   = end;
+    out[cnt].saved = perms[1] != 'w' || perms[3] != 'p' ? 0 :
+                     strcmp((char*)path, "[stack]") ? 1 : 2;
+    out[cnt].slot  = NULL;
+    cnt++;
+
+  }
+
+  return cnt;
+
+}
+
+
+/* Read the pagemap entries for npg pages from addr on into snap->buf. */
+
+static u8 __afl_snap_pagemap(u8* addr, u64 npg) {
+
+  u64 len = npg * 8;
+
+  return pread(snap->pagemap_fd, snap->buf, len,
+               ((u64)addr / snap_page) * 8) == len;
+
+}
+
+
+/* Reset the soft-dirty bits of all our pages. */
+
+static u8 __afl_snap_clear(void) {
+
+  return pwrite(snap->clear_fd, "4", 1, 0) == 1;
+
+}
+
+
+/* Walk the pages of a saved mapping, one pagemap chunk at a time, calling
+   fn() for each of them. */
+
+static u8 __afl_snap_walk(struct snap_map* m,
+                          void (*fn)(struct snap_map*, u64, u64)) {
+
+  u64 total = (m->end - m->start) / snap_page, done = 0;
+
+  while (done < total) {
+
+    u64 npg = total - done, i;
+
+    if (npg > SNAP_BUF_SIZE / 8) npg = SNAP_BUF_SIZE / 8;
+
+    if (!__afl_snap_pagemap(m->start + done * snap_page, npg)) return 0;
+
+    for (i = 0; i < npg; i++)
+      fn(m, done + i, ((u64*)snap->buf)[i]);
+
+    done += npg;
+
+  }
+
+  return 1;
+
+}
+
+
+static void __afl_snap_count(struct snap_map* m, u64 pg, u64 ent) {
+
+  if (ent & (PM_PRESENT | PM_SWAPPED)) snap->store_len += snap_page;
+
+}
+
+
+static void __afl_snap_save(struct snap_map* m, u64 pg, u64 ent) {
+
+  if (ent & (PM_PRESENT | PM_SWAPPED)) {
+
+    /* Pages faulted in since they were counted (stack, GOT) don't fit. */
+
+    if (snap->store_len + snap_page > snap->store_cap) {
+      snap->store_over = 1;
+      m->slot[pg] = ~0;
+      return;
+    }
+
+    m->slot[pg] = snap->store_len / snap_page;
+    memcpy(snap->store + snap->store_len, m->start + pg * snap_page,
+           snap_page);
+    snap->store_len += snap_page;
+
+  } else m->slot[pg] = ~0;
+
+}
+
+
+/* Pages that weren't there at snapshot time are dropped; anonymous ones
+   come back zeroed, file-backed ones re-read from the file. */
+
+static void __afl_snap_restore(struct snap_map* m, u64 pg, u64 ent) {
+
+  u8* addr = m->start + pg * snap_page;
+
+  if (!(ent & PM_SOFT_DIRTY)) return;
+
+  if (m->slot[pg] != ~0)
+    memcpy(addr, snap->store + (u64)m->slot[pg] * snap_page, snap_page);
+  else if (ent & (PM_PRESENT | PM_SWAPPED))
+    madvise(addr, snap_page, MADV_DONTNEED);
+
+}
+
+
+/* Go through /proc/self/fd, calling fn() for every descriptor but the one
+   used for the listing. */
+
+static u8 __afl_snap_fds(void (*fn)(s32)) {
+
+  s32 dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY), n;
+
+  if (dir < 0) return 0;
+
+  while ((n = syscall(SYS_getdents64, dir, snap->buf, SNAP_BUF_SIZE)) > 0) {
+
+    s32 off = 0;
+
+    while (off < n) {
+
+      struct linux_dirent64* d = (struct linux_dirent64*)(snap->buf + off);
+
+      if (d->d_name[0] != '.' && atoi(d->d_name) != dir)
+        fn(atoi(d->d_name));
+
+      off += d->d_reclen;
+
+    }
+
+  }
+
+  close(dir);
+  return !n;
+
+}
+
+
+static void __afl_snap_fd_save(s32 fd) {
+
+  if (fd >= SNAP_MAX_FDS) {
+    snap->fd_over = 1;
+    return;
+  }
+
+  snap->fd_open[fd] = 1;
+  snap->fd_off[fd]  = lseek(fd, 0, SEEK_CUR);
+
+}
+
+
+static void __afl_snap_fd_restore(s32 fd) {
+
+  if (fd < SNAP_MAX_FDS && snap->fd_open[fd]) snap->fd_open[fd] |= 2;
+  else close(fd);
+
+}
+
+
+/* Roll everything back to the snapshot. Returns 0 if that can't be done. */
+
+static u8 __afl_snap_rollback(void) {
+
+  s32 cnt, i, j;
+
+  /* Give back the heap grown during the run (or get back what was given
+     away; those pages come up soft-dirty and are restored below). */
+
+  if (sbrk(0) != snap->brk && brk(snap->brk)) return 0;
+
+  if ((cnt = __afl_snap_read_maps(snap->cur)) < 0) return 0;
+  snap->cur_cnt = cnt;
+
+  /* Unmap whatever wasn't there at snapshot time. Both lists are sorted,
+     and mappings may well have been merged with older ones. */
+
+  for (i = 0; i < cnt; i++) {
+
+    struct snap_map* c = &snap->cur[i];
+    u8* at = c->start;
+
+    if (__afl_snap_own(c->start) || c->saved == 2) continue;
+
+    for (j = 0; j < snap->map_cnt && at < c->end; j++) {
+
+      struct snap_map* m = &snap->maps[j];
+
+      if (m->end <= at || m->start >= c->end) continue;
+      if (m->start > at) munmap(at, m->start - at);
+      at = m->end;
+
+    }
+
+    if (at < c->end) munmap(at, c->end - at);
+
+  }
+
+  /* Every saved mapping must still be there, private and writable. */
+
+  for (j = 0; j < snap->map_cnt; j++) {
+
+    struct snap_map* m = &snap->maps[j];
+    u8* at = m->start;
+
+    if (!m->saved) continue;
+
+    for (i = 0; i < cnt && at < m->end; i++) {
+
+      struct snap_map* c = &snap->cur[i];
+
+      if (c->start <= at && at < c->end && c->saved) at = c->end;
+
+    }
+
+    if (at < m->end) return 0;
+
+  }
+
+  for (j = 0; j < snap->map_cnt; j++)
+    if (snap->maps[j].saved &&
+        !__afl_snap_walk(&snap->maps[j], __afl_snap_restore)) return 0;
+
+  /* Close what was opened during the run, rewind what was there before. */
+
+  if (!__afl_snap_fds(__afl_snap_fd_restore)) return 0;
+
+  for (i = 0; i < SNAP_MAX_FDS; i++) {
+
+    if (!snap->fd_open[i]) continue;
+
+    /* Closed during the run, no way to get it back. */
+
+    if (snap->fd_open[i] != 3) return 0;
+    snap->fd_open[i] = 1;
+
+    if (snap->fd_off[i] >= 0) lseek(i, snap->fd_off[i], SEEK_SET);
+
+  }
+
+  return __afl_snap_clear();
+
+}
+
+
+/* Runs on the engine's stack, since the real one is about to be rolled
+   back. */
+
+static void __afl_snap_next(void) {
+
+  if (!__afl_snap_rollback()) _exit(0);
+
+  raise(SIGSTOP);
+
+  snap->resumed = 1;
+  setcontext(&snap->snap_ctx);
+
+}
+
+
+/* End of a run. Doesn't return, unless we're not the snapshot. */
+
+static void __afl_snapshot_end(void) {
+
+  if (!snap || !snap->pid || syscall(SYS_getpid) != snap->pid) return;
+
+  getcontext(&snap->end_ctx);
+
+  snap->end_ctx.uc_stack.ss_sp   = snap->stack;
+  snap->end_ctx.uc_stack.ss_size = SNAP_STACK_SIZE;
+  snap->end_ctx.uc_link          = NULL;
+
+  makecontext(&snap->end_ctx, __afl_snap_next, 0);
+  setcontext(&snap->end_ctx);
+
+}
+
+
+/* Registered at snapshot time, so that it runs after the exit handlers
+   the run itself has set up, but before any older ones. MSAN's errors are
+   left to be seen by afl-fuzz. */
+
+static void __afl_snapshot_on_exit(int status, void* arg) {
+
+  if (status != MSAN_ERROR) __afl_snapshot_end();
+
+}
+
+
+/* Check whether the kernel keeps track of soft-dirty pages for us. */
+
+static u8 __afl_snap_soft_dirty(void) {
+
+  volatile u8 probe = 0;
+
+  if (!__afl_snap_clear()) return 0;
+
+  probe = 1;
+
+  return __afl_snap_pagemap((u8*)&probe, 1) &&
+         (*(u64*)snap->buf & PM_SOFT_DIRTY);
+
+}
+
+
+/* Take the snapshot, right after the fork. If anything about the process
+   doesn't suit us, we just carry on without one. */
+
+static void __afl_snapshot_take(void) {
+
+  u64 total = 0, slots = 0;
+  s32 cnt, i;
+
+  snap_page = sysconf(_SC_PAGESIZE);
+
+  snap = mmap(NULL, sizeof(struct snap_engine), PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (snap == MAP_FAILED) {
+    snap = NULL;
+    return;
+  }
+
+  snap->pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+  snap->clear_fd   = open("/proc/self/clear_refs", O_WRONLY);
+
+  if (snap->pagemap_fd < 0 || snap->clear_fd < 0 ||
+      !__afl_snap_soft_dirty()) goto give_up;
+
+  if (on_exit(__afl_snapshot_on_exit, NULL)) goto give_up;
+
+  if (!__afl_snap_fds(__afl_snap_fd_save) || snap->fd_over) goto give_up;
+
+  snap->brk = sbrk(0);
+
+  if ((cnt = __afl_snap_read_maps(snap->maps)) < 0) goto give_up;
+  snap->map_cnt = cnt;
+
+  for (i = 0; i < cnt; i++) {
+
+    if (!snap->maps[i].saved) continue;
+
+    total += snap->maps[i].end - snap->maps[i].start;
+    slots += (snap->maps[i].end - snap->maps[i].start) / snap_page;
+
+  }
+
+  if (total > (u64)SNAPSHOT_MAX_MB << 20) goto give_up;
+
+  for (i = 0; i < cnt; i++)
+    if (snap->maps[i].saved &&
+        !__afl_snap_walk(&snap->maps[i], __afl_snap_count)) goto give_up;
+
+  /* Backup pages first, then the per-page slot tables. */
+
+  snap->store_cap = snap->store_len;
+
+  total = snap->store_len + slots * sizeof(u32);
+
+  snap->store = mmap(NULL, total, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (snap->store == MAP_FAILED) {
+    snap->store = NULL;
+    goto give_up;
+  }
+
+  slots = snap->store_len;
+
+  for (i = 0; i < cnt; i++) {
+
+    struct snap_map* m = &snap->maps[i];
+
+    if (!m->saved) continue;
+
+    m->slot = (u32*)(snap->store + slots);
+    slots  += (m->end - m->start) / snap_page * sizeof(u32);
+
+  }
+
+  /* This is where every run after the first picks up from. */
+
+  getcontext(&snap->snap_ctx);
+
+  if (snap->resumed) return;
+
+  snap->store_len = 0;
+
+  for (i = 0; i < snap->map_cnt; i++)
+    if (snap->maps[i].saved &&
+        !__afl_snap_walk(&snap->maps[i], __afl_snap_save)) goto give_up;
+
+  if (snap->store_over || !__afl_snap_clear()) goto give_up;
+
+  snap->pid = syscall(SYS_getpid);
+  return;
+
+give_up:
+
+  /* The exit handler, if already set up, stays; it won't do anything
+     without a pid. */
+
+  if (snap->store) munmap(snap->store, total);
+  if (snap->pagemap_fd >= 0) close(snap->pagemap_fd);
+  if (snap->clear_fd >= 0) close(snap->clear_fd);
+  munmap(snap, sizeof(struct snap_engine));
+  snap = NULL;
+
+}
+
+#else
+
+static void __afl_snapshot_end(void) { }
+static void __afl_snapshot_take(void) { }
+
+#endif /* ^__linux__ */
+
+
+
+/* Blocks built with AFL_PDGF_SINK_EXIT check this and call __afl_sink_exit()
+   once execution can't get back into the region. It is only ever set in
+   the director's children: the checker has to see all of the path, and
+   anything running outside of afl-fuzz, or before the fork, runs as
+   usual. */
+
+u8 __afl_sink_armed;
+
+void __afl_sink_exit(void) {
+
+  __afl_snapshot_end();
+  _exit(0);
+
+}
+
+
+/* In navigator mode, the checker has its markers replaced with int3. Any of
+   them hit before the forkserver is up (deferred init, early constructors)
+   are simply stepped over - the next byte is a nop. */
+
+static void __afl_nav_trap(int sig) { }
+
+
 /* SHM setup. */
 
 static void __afl_map_shm(void) {
@@ -98,6 +729,28 @@ static void __afl_map_shm(void) {
 }
 
 
+/* Attach to the testcase region, if the harness wants it and afl-fuzz
+   offered one. Returns 1 on success. */
+
+static u8 __afl_map_shm_fuzz(void) {
+
+  u8 *id_str = getenv(SHM_FUZZ_ENV_VAR);
+  u8 *mem;
+
+  if (!__afl_sharedmem_fuzzing || !id_str) return 0;
+
+  mem = shmat(atoi(id_str), NULL, 0);
+
+  if (mem == (void *)-1) _exit(1);
+
+  __afl_fuzz_len = (u32*)mem;
+  __afl_fuzz_ptr = mem + sizeof(u32);
+
+  return 1;
+
+}
+
+
 /* Fork server logic. */
 
 static void __afl_start_forkserver(void) {
@@ -106,11 +759,31 @@ static void __afl_start_forkserver(void) {
   s32 child_pid;
 
   u8  child_stopped = 0;
+  u8  shm_fuzz = __afl_map_shm_fuzz();
 
   /* Phone home and tell the parent that we're OK. If parent isn't there,
-     assume we're not running in forkserver mode and just execute program. */
+     assume we're not running in forkserver mode and just execute program.
+     The navigator wants to hear a distinctive hello; everyone else gets our
+     map size, so that afl-fuzz can check it against its SHM region, and
+     whether we read testcases from SHM. */
+
+  if (is_nav) *(u32*)tmp = NAV_FORKSRV_HELLO;
+  else *(u32*)tmp = FORKSRV_MAP_HELLO | __afl_map_size() |
+                    (shm_fuzz ? FORKSRV_SHM_FUZZ : 0);
+
+  if (write(FORKSRV_FD + 1, tmp, 4) != 4) {
+
+    /* Without a forkserver, afl-fuzz writes the testcase out as usual. */
+
+    if (shm_fuzz) {
+      shmdt(__afl_fuzz_len);
+      __afl_fuzz_len = &__afl_fuzz_len_dummy;
+      __afl_fuzz_ptr = NULL;
+    }
 
-  if (write(FORKSRV_FD + 1, tmp, 4) != 4) return;
+    return;
+
+  }
 
   while (1) {
 
@@ -141,8 +814,22 @@ static void __afl_start_forkserver(void) {
 
       if (!child_pid) {
 
+        /* The navigator needs to PTRACE_SEIZE us before we run into the
+           first marker; it tells us when it's done via the control pipe. */
+
+        if (is_nav) {
+
+          signal(SIGTRAP, SIG_DFL);
+          if (read(FORKSRV_FD, tmp, 4) != 4) _exit(1);
+
+        }
+
+        if (!is_nav && getenv(SINK_ENV_VAR)) __afl_sink_armed = 1;
+
         close(FORKSRV_FD);
         close(FORKSRV_FD + 1);
+
+        if (snap_mode) __afl_snapshot_take();
         return;
   
       }
@@ -161,12 +848,13 @@ static void __afl_start_forkserver(void) {
 
     if (write(FORKSRV_FD + 1, &child_pid, 4) != 4) _exit(1);
 
-    if (waitpid(child_pid, &status, is_persistent ? WUNTRACED : 0) < 0)
+    if (waitpid(child_pid, &status,
+                (is_persistent || snap_mode) ? WUNTRACED : 0) < 0)
       _exit(1);
 
-    /* In persistent mode, the child stops itself with SIGSTOP to indicate
-       a successful run. In this case, we want to wake it up without forking
-       again. */
+    /* In persistent and snapshot mode, the child stops itself with SIGSTOP
+       to indicate a successful run. In this case, we want to wake it up
+       without forking again. */
 
     if (WIFSTOPPED(status)) child_stopped = 1;
 
@@ -195,7 +883,7 @@ int __afl_persistent_loop(unsigned int max_cnt) {
 
     if (is_persistent) {
 
-      memset(__afl_area_ptr, 0, MAP_SIZE);
+      memset(__afl_area_ptr, 0, __afl_map_size() + PDGF_MAX_TARGETS);
       __afl_area_ptr[0] = 1;
       __afl_prev_loc = 0;
     }
@@ -257,6 +945,10 @@ void __afl_manual_init(void) {
 __attribute__((constructor(CONST_PRIO))) void __afl_auto_init(void) {
 
   is_persistent = !!getenv(PERSIST_ENV_VAR);
+  is_nav = !!getenv(NAV_FORKSRV_ENV_VAR);
+  snap_mode = getenv(SNAPSHOT_ENV_VAR) && !is_persistent && !is_nav;
+
+  if (is_nav) signal(SIGTRAP, __afl_nav_trap);
 
   if (getenv(DEFER_ENV_VAR)) return;
 
@@ -300,11 +992,11 @@ void __sanitizer_cov_trace_pc_guard_init(uint32_t* start, uint32_t* stop) {
      to avoid duplicate calls (which can happen as an artifact of the underlying
      implementation in LLVM). */
 
-  *(start++) = R(MAP_SIZE - 1) + 1;
+  *(start++) = R(__afl_map_size() - 1) + 1;
 
   while (start < stop) {
 
-    if (R(100) < inst_ratio) *start = R(MAP_SIZE - 1) + 1;
+    if (R(100) < inst_ratio) *start = R(__afl_map_size() - 1) + 1;
     else *start = 0;
 
     start++;
@@ -8,6 +8,11 @@
 #include "SABER/LeakChecker.h"
 #include "SVF-FE/PAGBuilder.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include <fstream>
 #include <sstream>
 
@@ -20,9 +25,13 @@ ICFG *icfg;
 Module *M;
 LLVMContext *C;
 int pre_edges = 0;
+std::set<std::pair<const ICFGNode *, const ICFGNode *>> region_edges;
 
 ofstream pbb_outfile("premake_results.txt", std::ios::out);
 ofstream pe_outfile("pre_edges.txt", std::ios::out);
+ofstream re_outfile("region_edges.txt", std::ios::out);
+ofstream di_outfile("deferred_init.txt", std::ios::out);
+ofstream sb_outfile("sink_blocks.txt", std::ios::out);
 
 static llvm::cl::opt<std::string> InputFilename(cl::Positional,
                                                 llvm::cl::desc("<input bitcode>"), llvm::cl::init("-"));
@@ -168,6 +177,7 @@ std::vector<ICFGNode *> traverseOnICFG(ICFG *icfg, std::vector<NodeID> target_No
                 if (edge->getEdgeKind() == 2)
                     continue;
                 ICFGNode *preNode = edge->getSrcNode();
+                region_edges.insert(make_pair(preNode, iNode));
                 if (pre_ICFGNode.find(preNode) == pre_ICFGNode.end())
                 {
                     pre_ICFGNode.insert(preNode);
@@ -238,36 +248,275 @@ std::vector<ICFGNode *> traverseOnICFG(ICFG *icfg, std::vector<NodeID> target_No
 //     return std::vector<ICFGNode *>(pre_ICFGNode.begin(), pre_ICFGNode.end());
 // }
 
+// "file,line" name of the basic block holding a node, as used by the
+// LLVM pass; empty if the block has no usable debug location
+std::string getBBName(const ICFGNode *node)
+{
+    if (!node->getBB())
+        return "";
+    string strNode = getDebugInfo_const(node->getBB());
+    if (strNode.find("fl:") == strNode.npos || strNode.find("ln:") == strNode.npos)
+        return "";
+
+    string out_str;
+    if (strNode.find('/') != string::npos)
+        out_str += strNode.substr(strNode.find_last_of('/') + 1, strNode.find_last_of(' ') - strNode.find_last_of('/') - 1);
+    else
+        out_str += strNode.substr(strNode.find_last_of('fl:') + 2, strNode.find_last_of(' ') - strNode.find_last_of('fl:') - 2);
+
+    out_str += ',';
+
+    if (strNode.find("  cl") != strNode.npos)
+        out_str += strNode.substr(strNode.find("ln:") + 4, strNode.find("  cl") - strNode.find("ln:") - 4);
+    else
+        out_str += strNode.substr(strNode.find("ln:") + 4, strNode.find(" fl") - strNode.find("ln:") - 4);
+
+    return out_str;
+}
+
 void outputResult(std::vector<ICFGNode *> pre_ICFGNode)
 {
     std::cout << "-- Output the results --" << endl;
     std::set<string> output_pbb_str;
     for (auto node : pre_ICFGNode)
     {
-        string strNode = getDebugInfo_const(node->getBB());
-        if (strNode.find("fl:") != strNode.npos && strNode.find("ln:") != strNode.npos)
+        string out_str = getBBName(node);
+        if (!out_str.empty())
+            output_pbb_str.insert(out_str);
+    }
+    for (auto s : output_pbb_str)
+    {
+        pbb_outfile << s << endl;
+    }
+    pbb_outfile.close();
+
+    // Block-level edges inside the region, as pairs of line numbers (from 0)
+    // in premake_results.txt. The pass numbers region blocks the same way
+    // and gives each of these edges a map slot of its own.
+    std::map<string, u32_t> index;
+    for (auto s : output_pbb_str)
+    {
+        u32_t n = index.size();
+        index[s] = n;
+    }
+
+    std::set<std::pair<u32_t, u32_t>> output_edges;
+    for (auto e : region_edges)
+    {
+        auto src = index.find(getBBName(e.first));
+        auto dst = index.find(getBBName(e.second));
+        if (src == index.end() || dst == index.end() || src == dst)
+            continue;
+        output_edges.insert(make_pair(src->second, dst->second));
+    }
+    for (auto e : output_edges)
+    {
+        re_outfile << e.first << ' ' << e.second << endl;
+    }
+    re_outfile.close();
+    std::cout << "region edges is " << output_edges.size() << endl;
+}
+
+// Blocks from which the region can't be reached any more, not even by
+// returning to a caller: everything that can reach a region node (or a
+// target) over any ICFG edge is collected backwards, and the rest are
+// sinks. Blocks are named by "file,line" like in premake_results.txt; a name
+// shared with a block that is not a sink is left out. With
+// AFL_PDGF_SINK_EXIT, the director exits in these blocks.
+void outputSinks(std::vector<ICFGNode *> pre_ICFGNode, std::vector<NodeID> target_NodeID)
+{
+    std::set<const ICFGNode *> reach;
+    FIFOWorkList<const ICFGNode *> worklist;
+    for (auto node : pre_ICFGNode)
+        if (reach.insert(node).second)
+            worklist.push(node);
+    for (NodeID id : target_NodeID)
+        if (reach.insert(icfg->getICFGNode(id)).second)
+            worklist.push(icfg->getICFGNode(id));
+
+    while (!worklist.empty())
+    {
+        const ICFGNode *iNode = worklist.pop();
+        for (auto it = iNode->InEdgeBegin(), eit = iNode->InEdgeEnd(); it != eit; ++it)
         {
-            string out_str;
-            if (strNode.find('/') != string::npos)
-                out_str += strNode.substr(strNode.find_last_of('/') + 1, strNode.find_last_of(' ') - strNode.find_last_of('/') - 1);
-            else
-                out_str += strNode.substr(strNode.find_last_of('fl:') + 2, strNode.find_last_of(' ') - strNode.find_last_of('fl:') - 2);
+            const ICFGNode *preNode = (*it)->getSrcNode();
+            if (reach.insert(preNode).second)
+                worklist.push(preNode);
+        }
+    }
 
-            out_str += ',';
+    std::set<string> sink_names, other_names;
+    for (auto it = icfg->begin(), eit = icfg->end(); it != eit; ++it)
+    {
+        string name = getBBName(it->second);
+        if (name.empty())
+            continue;
+        if (reach.count(it->second))
+            other_names.insert(name);
+        else
+            sink_names.insert(name);
+    }
+
+    u32_t sinks = 0;
+    for (auto s : sink_names)
+    {
+        if (other_names.count(s))
+            continue;
+        sb_outfile << s << endl;
+        sinks++;
+    }
+    sb_outfile.close();
+    std::cout << "sink blocks is " << sinks << endl;
+}
 
-            if (strNode.find("  cl") != strNode.npos)
-                out_str += strNode.substr(strNode.find("ln:") + 4, strNode.find("  cl") - strNode.find("ln:") - 4);
-            else
-                out_str += strNode.substr(strNode.find("ln:") + 4, strNode.find(" fl") - strNode.find("ln:") - 4);
+// Functions that read the input (the @@ file or stdin), or that make forking
+// a copy of the process unsafe. Anything calling them, directly or through
+// other functions, must run after the forkserver is up.
+static const char *input_funcs[] = {
+    "read", "pread", "pread64", "readv", "fread", "fread_unlocked", "fgets",
+    "fgetc", "getc", "getc_unlocked", "getchar", "getline", "getdelim",
+    "scanf", "fscanf", "vfscanf", "__isoc99_scanf", "__isoc99_fscanf",
+    "open", "open64", "openat", "creat", "fopen", "fopen64", "freopen",
+    "fdopen", "mmap", "mmap64", "stat", "stat64", "lstat", "fstat", "fstat64",
+    "__xstat", "__xstat64", "__fxstat", "__fxstat64", "__lxstat", "access",
+    "lseek", "lseek64", "fseek", "ftell", "rewind", "pthread_create", "fork",
+    "vfork", "clone", nullptr};
 
-            output_pbb_str.insert(out_str);
+static bool isInputFunc(const Function *F)
+{
+    StringRef name = F->getName();
+    for (const char **n = input_funcs; *n; n++)
+        if (name == *n)
+            return true;
+    // iostreams
+    return name.startswith("_ZNSi") || name.startswith("_ZNSt14basic_ifstream") ||
+           name.startswith("_ZNSt13basic_filebuf");
+}
+
+// Functions that may end up in an input function; indirect calls count as
+// reaching one
+std::set<const Function *> computeInputReach(Module *mod)
+{
+    std::set<const Function *> reach;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (Function &F : *mod)
+        {
+            if (reach.count(&F))
+                continue;
+            bool r = F.isDeclaration() ? isInputFunc(&F) : false;
+            for (inst_iterator it = inst_begin(F), eit = inst_end(F); !r && it != eit; ++it)
+            {
+                const CallBase *cb = SVFUtil::dyn_cast<CallBase>(&*it);
+                if (!cb || cb->isInlineAsm() || SVFUtil::isa<IntrinsicInst>(cb))
+                    continue;
+                const Function *callee = cb->getCalledFunction();
+                r = !callee || reach.count(callee);
+            }
+            if (r)
+            {
+                reach.insert(&F);
+                changed = true;
+            }
         }
     }
-    for (auto s : output_pbb_str)
+    return reach;
+}
+
+static bool isInputCall(const Instruction *I, const std::set<const Function *> &reach)
+{
+    const CallBase *cb = SVFUtil::dyn_cast<CallBase>(I);
+    if (!cb || cb->isInlineAsm() || SVFUtil::isa<IntrinsicInst>(cb))
+        return false;
+    const Function *callee = cb->getCalledFunction();
+    return !callee || reach.count(callee);
+}
+
+// Is there an input call on some path from 'from' to 'to' (not counting
+// either block)?
+static bool inputCallBetween(BasicBlock *from, BasicBlock *to, const std::set<const Function *> &reach)
+{
+    std::set<BasicBlock *> seen;
+    FIFOWorkList<BasicBlock *> worklist;
+    for (BasicBlock *succ : successors(from))
+        worklist.push(succ);
+    while (!worklist.empty())
     {
-        pbb_outfile << s << endl;
+        BasicBlock *bb = worklist.pop();
+        if (bb == to || !seen.insert(bb).second)
+            continue;
+        for (Instruction &I : *bb)
+            if (isInputCall(&I, reach))
+                return true;
+        for (BasicBlock *succ : successors(bb))
+            worklist.push(succ);
     }
-    pbb_outfile.close();
+    return false;
+}
+
+// Find the latest point in main that runs once and comes before anything
+// reading the input: walk down the blocks that all of main goes through
+// (each one dominating and post-dominating the last), as long as nothing
+// in between reads the input and the next block is not in a loop. The
+// point is written out as "file,line" for the LLVM pass
+// (AFL_PDGF_AUTO_DEFER).
+void outputDeferredInit()
+{
+    Function *mainF = M->getFunction("main");
+    if (!mainF || mainF->isDeclaration())
+    {
+        di_outfile.close();
+        return;
+    }
+
+    std::set<const Function *> reach = computeInputReach(M);
+    DominatorTree DT(*mainF);
+    PostDominatorTree PDT(*mainF);
+    LoopInfo LI(DT);
+
+    BasicBlock *bb = &mainF->getEntryBlock();
+    Instruction *point = nullptr;
+    while (!point)
+    {
+        for (Instruction &I : *bb)
+        {
+            if (isInputCall(&I, reach))
+            {
+                point = &I;
+                break;
+            }
+        }
+        if (point)
+            break;
+
+        DomTreeNode *pn = PDT.getNode(bb) ? PDT.getNode(bb)->getIDom() : nullptr;
+        BasicBlock *next = pn ? pn->getBlock() : nullptr;
+        if (!next || LI.getLoopFor(next) || !DT.dominates(bb, next) ||
+            inputCallBetween(bb, next, reach))
+        {
+            point = bb->getTerminator();
+            break;
+        }
+        bb = next;
+    }
+
+    // Go back to the closest instruction with a line number
+    const DILocation *loc = nullptr;
+    for (Instruction *I = point; I && !loc; I = I->getPrevNode())
+        if (I->getDebugLoc() && I->getDebugLoc()->getLine())
+            loc = I->getDebugLoc();
+
+    if (loc)
+    {
+        std::string file = loc->getFilename().str();
+        if (file.find('/') != string::npos)
+            file = file.substr(file.find_last_of('/') + 1);
+        di_outfile << file << ',' << loc->getLine() << endl;
+        std::cout << "deferred init at " << file << ',' << loc->getLine() << endl;
+    }
+    di_outfile.close();
 }
 
 int main(int argc, char **argv)
@@ -294,6 +543,10 @@ int main(int argc, char **argv)
 
     outputResult(pre_ICFGNode);
 
+    outputSinks(pre_ICFGNode, target_NodeID);
+
+    outputDeferredInit();
+
     pe_outfile << pre_edges;
     std::cout << "pre_edges is " << pre_edges << endl;
 }